@@ -1,4 +1,369 @@
 #include <stdint.h>
+#include <cstddef>
+#include <cstring>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && ((__GNUC__ > 4) || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9) || defined(__clang__))
+#define CUBEHASH_X86_VECTOR 1
+#include <immintrin.h>
+#endif
+#if defined(__clang__) || (defined(__GNUC__) && (__GNUC__ >= 8))
+#define CUBEHASH_UNROLL _Pragma("GCC unroll 32")
+#else
+#define CUBEHASH_UNROLL
+#endif
+
+/* The CubeHash round function **********************************************
+// **************************************************************************
+*/
+
+namespace CubeHashRound {
+
+	enum { STATE_WORDS = 32, HALF_LENGTH = STATE_WORDS / 2 };
+
+	typedef void (*transform_function)(uint32_t x[STATE_WORDS], unsigned int rounds);
+
+	static inline uint32_t ROTATE(uint32_t a, uint32_t b) { return (a << b) | (a >> (32U - b)); }
+
+	// This is the reference implementation of one round.
+	static inline
+	void
+	round_scalar (
+		uint32_t x[STATE_WORDS]
+	) {
+		uint32_t y[HALF_LENGTH];
+
+		for (unsigned i = 0;i < HALF_LENGTH;++i) x[i + HALF_LENGTH] += x[i];
+		for (unsigned i = 0;i < HALF_LENGTH;++i) y[i ^ 8] = x[i];
+		for (unsigned i = 0;i < HALF_LENGTH;++i) x[i] = ROTATE(y[i],7);
+		for (unsigned i = 0;i < HALF_LENGTH;++i) x[i] ^= x[i + HALF_LENGTH];
+		for (unsigned i = 0;i < HALF_LENGTH;++i) y[i ^ 2] = x[i + HALF_LENGTH];
+		for (unsigned i = 0;i < HALF_LENGTH;++i) x[i + HALF_LENGTH] = y[i];
+		for (unsigned i = 0;i < HALF_LENGTH;++i) x[i + HALF_LENGTH] += x[i];
+		for (unsigned i = 0;i < HALF_LENGTH;++i) y[i ^ 4] = x[i];
+		for (unsigned i = 0;i < HALF_LENGTH;++i) x[i] = ROTATE(y[i],11);
+		for (unsigned i = 0;i < HALF_LENGTH;++i) x[i] ^= x[i + HALF_LENGTH];
+		for (unsigned i = 0;i < HALF_LENGTH;++i) y[i ^ 1] = x[i + HALF_LENGTH];
+		for (unsigned i = 0;i < HALF_LENGTH;++i) x[i + HALF_LENGTH] = y[i];
+	}
+
+	// This is the fallback for when there is no vector unit.
+	static inline
+	void
+	transform_scalar (
+		uint32_t x[STATE_WORDS],
+		unsigned int rounds
+	) {
+		for (unsigned r = rounds;r > 0;--r)
+			round_scalar(x);
+	}
+
+	// When the number of rounds is a compile-time constant, the scalar rounds are fully unrolled.
+	template <unsigned int ROUNDS> struct UnrolledRounds {
+		static void apply(uint32_t x[STATE_WORDS]) { round_scalar(x); UnrolledRounds<ROUNDS - 1U>::apply(x); }
+	};
+	template <> struct UnrolledRounds<0U> {
+		static void apply(uint32_t *) {}
+	};
+
+	template <unsigned int ROUNDS>
+	static inline
+	void
+	transform_unrolled (
+		uint32_t x[STATE_WORDS],
+		unsigned int
+	) {
+		UnrolledRounds<ROUNDS>::apply(x);
+	}
+
+#if defined(CUBEHASH_X86_VECTOR)
+	// The permutations of the round function are all within the state, so each one is either a renaming of whole registers or a shuffle within a register.
+	// x[i ^ 8] and x[i ^ 4] swap whole 256-bit and 128-bit groups; x[i ^ 2] and x[i ^ 1] are swaps within a 128-bit lane.
+
+	__attribute__((target("sse2")))
+	static inline __m128i rotate_sse2(__m128i a, int b) { return _mm_or_si128(_mm_slli_epi32(a, b), _mm_srli_epi32(a, 32 - b)); }
+
+	__attribute__((target("sse2")))
+	static
+	void
+	transform_sse2 (
+		uint32_t x[STATE_WORDS],
+		unsigned int rounds
+	) {
+		__m128i * const p(reinterpret_cast<__m128i *>(x));
+		__m128i x0(_mm_loadu_si128(p + 0)), x1(_mm_loadu_si128(p + 1)), x2(_mm_loadu_si128(p + 2)), x3(_mm_loadu_si128(p + 3));
+		__m128i x4(_mm_loadu_si128(p + 4)), x5(_mm_loadu_si128(p + 5)), x6(_mm_loadu_si128(p + 6)), x7(_mm_loadu_si128(p + 7));
+		for (unsigned r = rounds;r > 0;--r) {
+			x4 = _mm_add_epi32(x0, x4);
+			x5 = _mm_add_epi32(x1, x5);
+			x6 = _mm_add_epi32(x2, x6);
+			x7 = _mm_add_epi32(x3, x7);
+			__m128i y0(x2), y1(x3), y2(x0), y3(x1);
+			x0 = _mm_xor_si128(rotate_sse2(y0, 7), x4);
+			x1 = _mm_xor_si128(rotate_sse2(y1, 7), x5);
+			x2 = _mm_xor_si128(rotate_sse2(y2, 7), x6);
+			x3 = _mm_xor_si128(rotate_sse2(y3, 7), x7);
+			x4 = _mm_shuffle_epi32(x4, 0x4E);
+			x5 = _mm_shuffle_epi32(x5, 0x4E);
+			x6 = _mm_shuffle_epi32(x6, 0x4E);
+			x7 = _mm_shuffle_epi32(x7, 0x4E);
+			x4 = _mm_add_epi32(x0, x4);
+			x5 = _mm_add_epi32(x1, x5);
+			x6 = _mm_add_epi32(x2, x6);
+			x7 = _mm_add_epi32(x3, x7);
+			y0 = x1; y1 = x0; y2 = x3; y3 = x2;
+			x0 = _mm_xor_si128(rotate_sse2(y0, 11), x4);
+			x1 = _mm_xor_si128(rotate_sse2(y1, 11), x5);
+			x2 = _mm_xor_si128(rotate_sse2(y2, 11), x6);
+			x3 = _mm_xor_si128(rotate_sse2(y3, 11), x7);
+			x4 = _mm_shuffle_epi32(x4, 0xB1);
+			x5 = _mm_shuffle_epi32(x5, 0xB1);
+			x6 = _mm_shuffle_epi32(x6, 0xB1);
+			x7 = _mm_shuffle_epi32(x7, 0xB1);
+		}
+		_mm_storeu_si128(p + 0, x0); _mm_storeu_si128(p + 1, x1); _mm_storeu_si128(p + 2, x2); _mm_storeu_si128(p + 3, x3);
+		_mm_storeu_si128(p + 4, x4); _mm_storeu_si128(p + 5, x5); _mm_storeu_si128(p + 6, x6); _mm_storeu_si128(p + 7, x7);
+	}
+
+	__attribute__((target("avx2")))
+	static inline __m256i rotate_avx2(__m256i a, int b) { return _mm256_or_si256(_mm256_slli_epi32(a, b), _mm256_srli_epi32(a, 32 - b)); }
+
+	__attribute__((target("avx2")))
+	static
+	void
+	transform_avx2 (
+		uint32_t x[STATE_WORDS],
+		unsigned int rounds
+	) {
+		__m256i * const p(reinterpret_cast<__m256i *>(x));
+		__m256i x0(_mm256_loadu_si256(p + 0)), x1(_mm256_loadu_si256(p + 1)), x2(_mm256_loadu_si256(p + 2)), x3(_mm256_loadu_si256(p + 3));
+		for (unsigned r = rounds;r > 0;--r) {
+			x2 = _mm256_add_epi32(x0, x2);
+			x3 = _mm256_add_epi32(x1, x3);
+			const __m256i y0(x1), y1(x0);
+			x0 = _mm256_xor_si256(rotate_avx2(y0, 7), x2);
+			x1 = _mm256_xor_si256(rotate_avx2(y1, 7), x3);
+			x2 = _mm256_shuffle_epi32(x2, 0x4E);
+			x3 = _mm256_shuffle_epi32(x3, 0x4E);
+			x2 = _mm256_add_epi32(x0, x2);
+			x3 = _mm256_add_epi32(x1, x3);
+			x0 = _mm256_xor_si256(rotate_avx2(_mm256_permute4x64_epi64(x0, 0x4E), 11), x2);
+			x1 = _mm256_xor_si256(rotate_avx2(_mm256_permute4x64_epi64(x1, 0x4E), 11), x3);
+			x2 = _mm256_shuffle_epi32(x2, 0xB1);
+			x3 = _mm256_shuffle_epi32(x3, 0xB1);
+		}
+		_mm256_storeu_si256(p + 0, x0); _mm256_storeu_si256(p + 1, x1); _mm256_storeu_si256(p + 2, x2); _mm256_storeu_si256(p + 3, x3);
+	}
+
+	// The full-mask forms are used because the unmasked intrinsics expand to an undefined source operand, about which some compilers spuriously warn.
+	// The rotation count of the instruction is an immediate, so it is a template parameter, which an unoptimized build does not have to propagate as a constant.
+	template <int B>
+	__attribute__((target("avx512f")))
+	static inline __m512i rotate_avx512(__m512i a) { return _mm512_mask_rol_epi32(a, 0xFFFF, a, B); }
+	__attribute__((target("avx512f")))
+	static inline __m512i swap_256_avx512(__m512i a) { return _mm512_mask_shuffle_i64x2(a, 0xFF, a, a, 0x4E); }
+	__attribute__((target("avx512f")))
+	static inline __m512i swap_128_avx512(__m512i a) { return _mm512_mask_shuffle_i32x4(a, 0xFFFF, a, a, 0xB1); }
+	__attribute__((target("avx512f")))
+	static inline __m512i swap_64_avx512(__m512i a) { return _mm512_mask_shuffle_epi32(a, 0xFFFF, a, _MM_PERM_BADC); }
+	__attribute__((target("avx512f")))
+	static inline __m512i swap_32_avx512(__m512i a) { return _mm512_mask_shuffle_epi32(a, 0xFFFF, a, _MM_PERM_CDAB); }
+
+	__attribute__((target("avx512f")))
+	static
+	void
+	transform_avx512 (
+		uint32_t x[STATE_WORDS],
+		unsigned int rounds
+	) {
+		__m512i a(_mm512_loadu_si512(x)), b(_mm512_loadu_si512(x + HALF_LENGTH));
+		for (unsigned r = rounds;r > 0;--r) {
+			b = _mm512_add_epi32(a, b);
+			a = _mm512_xor_si512(rotate_avx512<7>(swap_256_avx512(a)), b);
+			b = swap_64_avx512(b);
+			b = _mm512_add_epi32(a, b);
+			a = _mm512_xor_si512(rotate_avx512<11>(swap_128_avx512(a)), b);
+			b = swap_32_avx512(b);
+		}
+		_mm512_storeu_si512(x, a);
+		_mm512_storeu_si512(x + HALF_LENGTH, b);
+	}
+#endif
+
+	// A candidate is only ever used if it produces bit-for-bit the same state as the scalar code.
+	static inline
+	bool
+	agrees_with_scalar (
+		transform_function candidate
+	) {
+		uint32_t a[STATE_WORDS], b[STATE_WORDS];
+		for (unsigned i = 0;i < STATE_WORDS;++i) a[i] = b[i] = 0x9E3779B9U * (i + 1U);
+		transform_scalar(a, 17U);
+		candidate(b, 17U);
+		for (unsigned i = 0;i < STATE_WORDS;++i)
+			if (a[i] != b[i]) return false;
+		return true;
+	}
+
+	static inline
+	transform_function
+	select_transform()
+	{
+#if defined(CUBEHASH_X86_VECTOR)
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx512f") && agrees_with_scalar(transform_avx512)) return transform_avx512;
+		if (__builtin_cpu_supports("avx2") && agrees_with_scalar(transform_avx2)) return transform_avx2;
+		if (__builtin_cpu_supports("sse2") && agrees_with_scalar(transform_sse2)) return transform_sse2;
+#endif
+		return transform_scalar;
+	}
+
+	// The choice is made once, on first use, and is shared by every CubeHash instance.
+	static inline
+	transform_function
+	transform()
+	{
+		static const transform_function f(select_transform());
+		return f;
+	}
+
+	// The vector implementations are preferred over unrolled scalar code whenever they are available.
+	template <unsigned int ROUNDS>
+	static inline
+	transform_function
+	fixed_transform()
+	{
+		const transform_function f(transform());
+		return transform_scalar == f ? transform_unrolled<ROUNDS> : f;
+	}
+
+	/* Multiple-lane transforms ***********************************************
+	// ************************************************************************
+	*/
+
+	// These run several independent states in lockstep, one state per vector lane.
+	// The state is held word-major: x[w * lanes + l] is word w of the state in lane l.
+	// Every permutation of the round function thus becomes a mere renaming of registers, provided that the loops are fully unrolled.
+
+	enum { MAX_LANES = 16 };
+
+	typedef void (*multi_transform_function)(uint32_t * x, unsigned int rounds);
+
+	struct MultiTransform {
+		multi_transform_function function;
+		unsigned int lanes;
+	};
+
+#if defined(CUBEHASH_X86_VECTOR)
+	__attribute__((target("avx2")))
+	static
+	void
+	transform_avx2_x8 (
+		uint32_t * x,
+		unsigned int rounds
+	) {
+		__m256i * const p(reinterpret_cast<__m256i *>(x));
+		__m256i v[STATE_WORDS], y[HALF_LENGTH];
+		CUBEHASH_UNROLL for (unsigned i = 0;i < STATE_WORDS;++i) v[i] = _mm256_loadu_si256(p + i);
+		for (unsigned r = rounds;r > 0;--r) {
+			CUBEHASH_UNROLL for (unsigned i = 0;i < HALF_LENGTH;++i) v[i + HALF_LENGTH] = _mm256_add_epi32(v[i + HALF_LENGTH], v[i]);
+			CUBEHASH_UNROLL for (unsigned i = 0;i < HALF_LENGTH;++i) y[i ^ 8] = v[i];
+			CUBEHASH_UNROLL for (unsigned i = 0;i < HALF_LENGTH;++i) v[i] = _mm256_xor_si256(rotate_avx2(y[i], 7), v[i + HALF_LENGTH]);
+			CUBEHASH_UNROLL for (unsigned i = 0;i < HALF_LENGTH;++i) y[i ^ 2] = v[i + HALF_LENGTH];
+			CUBEHASH_UNROLL for (unsigned i = 0;i < HALF_LENGTH;++i) v[i + HALF_LENGTH] = _mm256_add_epi32(y[i], v[i]);
+			CUBEHASH_UNROLL for (unsigned i = 0;i < HALF_LENGTH;++i) y[i ^ 4] = v[i];
+			CUBEHASH_UNROLL for (unsigned i = 0;i < HALF_LENGTH;++i) v[i] = _mm256_xor_si256(rotate_avx2(y[i], 11), v[i + HALF_LENGTH]);
+			CUBEHASH_UNROLL for (unsigned i = 0;i < HALF_LENGTH;++i) y[i ^ 1] = v[i + HALF_LENGTH];
+			CUBEHASH_UNROLL for (unsigned i = 0;i < HALF_LENGTH;++i) v[i + HALF_LENGTH] = y[i];
+		}
+		CUBEHASH_UNROLL for (unsigned i = 0;i < STATE_WORDS;++i) _mm256_storeu_si256(p + i, v[i]);
+	}
+
+	__attribute__((target("avx512f")))
+	static
+	void
+	transform_avx512_x16 (
+		uint32_t * x,
+		unsigned int rounds
+	) {
+		__m512i v[STATE_WORDS], y[HALF_LENGTH];
+		CUBEHASH_UNROLL for (unsigned i = 0;i < STATE_WORDS;++i) v[i] = _mm512_loadu_si512(x + 16U * i);
+		for (unsigned r = rounds;r > 0;--r) {
+			CUBEHASH_UNROLL for (unsigned i = 0;i < HALF_LENGTH;++i) v[i + HALF_LENGTH] = _mm512_add_epi32(v[i + HALF_LENGTH], v[i]);
+			CUBEHASH_UNROLL for (unsigned i = 0;i < HALF_LENGTH;++i) y[i ^ 8] = v[i];
+			CUBEHASH_UNROLL for (unsigned i = 0;i < HALF_LENGTH;++i) v[i] = _mm512_xor_si512(rotate_avx512<7>(y[i]), v[i + HALF_LENGTH]);
+			CUBEHASH_UNROLL for (unsigned i = 0;i < HALF_LENGTH;++i) y[i ^ 2] = v[i + HALF_LENGTH];
+			CUBEHASH_UNROLL for (unsigned i = 0;i < HALF_LENGTH;++i) v[i + HALF_LENGTH] = _mm512_add_epi32(y[i], v[i]);
+			CUBEHASH_UNROLL for (unsigned i = 0;i < HALF_LENGTH;++i) y[i ^ 4] = v[i];
+			CUBEHASH_UNROLL for (unsigned i = 0;i < HALF_LENGTH;++i) v[i] = _mm512_xor_si512(rotate_avx512<11>(y[i]), v[i + HALF_LENGTH]);
+			CUBEHASH_UNROLL for (unsigned i = 0;i < HALF_LENGTH;++i) y[i ^ 1] = v[i + HALF_LENGTH];
+			CUBEHASH_UNROLL for (unsigned i = 0;i < HALF_LENGTH;++i) v[i + HALF_LENGTH] = y[i];
+		}
+		CUBEHASH_UNROLL for (unsigned i = 0;i < STATE_WORDS;++i) _mm512_storeu_si512(x + 16U * i, v[i]);
+	}
+#endif
+
+	// As with the single-state transforms, a candidate must agree bit-for-bit with the scalar code in every lane.
+	static inline
+	bool
+	agrees_with_scalar (
+		multi_transform_function candidate,
+		unsigned int lanes
+	) {
+		uint32_t a[MAX_LANES][STATE_WORDS], b[STATE_WORDS * MAX_LANES];
+		for (unsigned l = 0;l < lanes;++l)
+			for (unsigned i = 0;i < STATE_WORDS;++i)
+				a[l][i] = b[i * lanes + l] = 0x9E3779B9U * (i + 1U) + 0x7F4A7C15U * l;
+		for (unsigned l = 0;l < lanes;++l)
+			transform_scalar(a[l], 17U);
+		candidate(b, 17U);
+		for (unsigned l = 0;l < lanes;++l)
+			for (unsigned i = 0;i < STATE_WORDS;++i)
+				if (a[l][i] != b[i * lanes + l]) return false;
+		return true;
+	}
+
+	static inline
+	MultiTransform
+	select_multi_transform()
+	{
+		MultiTransform m = { 0, 1U };
+#if defined(CUBEHASH_X86_VECTOR)
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx512f") && agrees_with_scalar(transform_avx512_x16, 16U)) {
+			m.function = transform_avx512_x16;
+			m.lanes = 16U;
+		} else
+		if (__builtin_cpu_supports("avx2") && agrees_with_scalar(transform_avx2_x8, 8U)) {
+			m.function = transform_avx2_x8;
+			m.lanes = 8U;
+		}
+#endif
+		return m;
+	}
+
+	// A null function means that there is no multiple-lane transform on this processor.
+	static inline
+	const MultiTransform &
+	multi_transform()
+	{
+		static const MultiTransform m(select_multi_transform());
+		return m;
+	}
+
+	static inline
+	uint32_t
+	load_le32 (
+		const unsigned char * p
+	) {
+#if defined(__BYTE_ORDER__) && defined(__ORDER_LITTLE_ENDIAN__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+		uint32_t w;
+		std::memcpy(&w, p, sizeof w);
+		return w;
+#else
+		return uint32_t(p[0]) | (uint32_t(p[1]) << 8U) | (uint32_t(p[2]) << 16U) | (uint32_t(p[3]) << 24U);
+#endif
+	}
+
+}
 
 class CubeHash {
 public:
@@ -49,30 +414,9 @@ protected:
 	const unsigned int bytes_per_block;
 	const unsigned int hashbytelen;
 	unsigned int byte_pos; ///< number of bytes read into x from current block
-	uint32_t x[32];
-
-	uint32_t ROTATE(uint32_t a, uint32_t b) { return (a << b) | (a >> (32U - b)); }
-
-	void transform(unsigned int rounds)
-	{
-		enum { HALF_LENGTH = (sizeof x/sizeof *x) / 2 };
-		uint32_t y[HALF_LENGTH];
+	uint32_t x[CubeHashRound::STATE_WORDS];
 
-		for (unsigned r = rounds;r > 0;--r) {
-			for (unsigned i = 0;i < HALF_LENGTH;++i) x[i + HALF_LENGTH] += x[i];
-			for (unsigned i = 0;i < HALF_LENGTH;++i) y[i ^ 8] = x[i];
-			for (unsigned i = 0;i < HALF_LENGTH;++i) x[i] = ROTATE(y[i],7);
-			for (unsigned i = 0;i < HALF_LENGTH;++i) x[i] ^= x[i + HALF_LENGTH];
-			for (unsigned i = 0;i < HALF_LENGTH;++i) y[i ^ 2] = x[i + HALF_LENGTH];
-			for (unsigned i = 0;i < HALF_LENGTH;++i) x[i + HALF_LENGTH] = y[i];
-			for (unsigned i = 0;i < HALF_LENGTH;++i) x[i + HALF_LENGTH] += x[i];
-			for (unsigned i = 0;i < HALF_LENGTH;++i) y[i ^ 4] = x[i];
-			for (unsigned i = 0;i < HALF_LENGTH;++i) x[i] = ROTATE(y[i],11);
-			for (unsigned i = 0;i < HALF_LENGTH;++i) x[i] ^= x[i + HALF_LENGTH];
-			for (unsigned i = 0;i < HALF_LENGTH;++i) y[i ^ 1] = x[i + HALF_LENGTH];
-			for (unsigned i = 0;i < HALF_LENGTH;++i) x[i + HALF_LENGTH] = y[i];
-		}
-	}
+	void transform(unsigned int rounds) { CubeHashRound::transform()(x, rounds); }
 
 	void Init()
 	{
@@ -90,3 +434,196 @@ protected:
 		transform(initial_rounds);
 	}
 };
+
+template <unsigned int I, unsigned int R, unsigned int B, unsigned int F, unsigned int H> class MultiBufferCubeHash;
+
+/// \brief CubeHash with its tunable parameters fixed at compile time
+///
+/// This absorbs whole blocks as little-endian words rather than a byte at a time, and has no per-byte block boundary checks.
+/// The initial state depends only upon the parameters, and so is computed once and copied.
+template <unsigned int I, unsigned int R, unsigned int B, unsigned int F, unsigned int H>
+class FixedCubeHash {
+public:
+	enum { hashbytelen = (H + 7U) / 8U, bytes_per_block = B, words_per_block = B / 4U };
+	unsigned char hashval[hashbytelen];
+
+	FixedCubeHash() :
+		byte_pos(0)
+	{
+		Init();
+	}
+
+	void Update(const unsigned char *data, std::size_t databytelen)
+	{
+		while (byte_pos > 0U && databytelen > 0) {
+			absorb_byte(*data);
+			++data;
+			--databytelen;
+		}
+		const CubeHashRound::transform_function block_transform(CubeHashRound::fixed_transform<R>());
+		while (databytelen >= bytes_per_block) {
+			for (unsigned i = 0;i < words_per_block;++i)
+				x[i] ^= CubeHashRound::load_le32(data + 4U * i);
+			block_transform(x, R);
+			data += bytes_per_block;
+			databytelen -= bytes_per_block;
+		}
+		while (databytelen > 0) {
+			absorb_byte(*data);
+			++data;
+			--databytelen;
+		}
+	}
+
+	void Final()
+	{
+		const uint32_t u(uint32_t(128) << (8U * (byte_pos % 4U)));
+		x[byte_pos / 4U] ^= u;
+		CubeHashRound::fixed_transform<R>()(x, R);
+		x[31U] ^= 1U;
+		CubeHashRound::fixed_transform<F>()(x, F);
+		for (unsigned i = 0;i < hashbytelen;++i)
+			hashval[i] = static_cast<unsigned char>(x[i / 4U] >> (8U * (i % 4U)));
+	}
+
+protected:
+	// Compile-time checks of the tunable parameters.
+	typedef char valid_hash_length[(hashbytelen >= 1U && hashbytelen <= 64U) ? 1 : -1];
+	typedef char valid_number_of_rounds[(I && R && F) ? 1 : -1];
+	typedef char valid_bytes_per_block[(B >= 4U && B <= 128U && 0U == B % 4U) ? 1 : -1];
+
+	unsigned int byte_pos; ///< number of bytes read into x from current block
+	uint32_t x[CubeHashRound::STATE_WORDS];
+
+	void absorb_byte(unsigned char c)
+	{
+		x[byte_pos / 4U] ^= uint32_t(c) << (8U * (byte_pos % 4U));
+		if (++byte_pos == bytes_per_block) {
+			CubeHashRound::fixed_transform<R>()(x, R);
+			byte_pos = 0U;
+		}
+	}
+
+	friend class MultiBufferCubeHash<I, R, B, F, H>;
+
+	struct InitialState {
+		uint32_t iv[CubeHashRound::STATE_WORDS];
+		InitialState()
+		{
+			iv[0] = hashbytelen;
+			iv[1] = bytes_per_block;
+			iv[2] = R;
+			for (unsigned i = 3;i < CubeHashRound::STATE_WORDS;++i) iv[i] = 0;
+			CubeHashRound::fixed_transform<I>()(iv, I);
+		}
+	};
+
+	static const uint32_t * initial_state()
+	{
+		static const InitialState s;
+		return s.iv;
+	}
+
+	void Init()
+	{
+		std::memcpy(x, initial_state(), sizeof x);
+	}
+};
+
+// This is Dan Bernstein's SHA-3-AHS256 proposal from 2010-11.
+typedef FixedCubeHash<16U, 16U, 32U, 32U, 256U> CubeHashSHA3AHS256;
+
+/// \brief Hash several whole messages at once, one message per vector lane
+///
+/// Every step XORs one block into each lane and then runs R rounds across all lanes.
+/// Lanes that have finished with one message are immediately refilled from the remaining messages, so messages of different lengths do not hold each other up.
+/// The F final rounds are run as F/R steps, so that all lanes can stay in lockstep no matter what phase each one is in.
+template <unsigned int I, unsigned int R, unsigned int B, unsigned int F, unsigned int H>
+class MultiBufferCubeHash {
+public:
+	typedef FixedCubeHash<I, R, B, F, H> Single;
+	enum { hashbytelen = Single::hashbytelen, bytes_per_block = Single::bytes_per_block, words_per_block = Single::words_per_block };
+
+	struct Message {
+		const unsigned char * data;
+		std::size_t length;
+		unsigned char * hashval;	///< hashbytelen bytes
+	};
+
+	static bool available() { return 0 != CubeHashRound::multi_transform().function; }
+
+	static void hash(Message * messages, std::size_t count)
+	{
+		const CubeHashRound::MultiTransform & m(CubeHashRound::multi_transform());
+		if (!m.function || count < 2U) {
+			for (std::size_t j = 0;j < count;++j) {
+				Single h;
+				h.Update(messages[j].data, messages[j].length);
+				h.Final();
+				std::memcpy(messages[j].hashval, h.hashval, hashbytelen);
+			}
+			return;
+		}
+		const unsigned int lanes(m.lanes);
+		const uint32_t * const iv(Single::initial_state());
+		uint32_t x[CubeHashRound::STATE_WORDS * CubeHashRound::MAX_LANES];
+		Lane lane[CubeHashRound::MAX_LANES];
+		std::size_t next(0);
+		unsigned busy(0);
+		for (unsigned l = 0;l < lanes;++l) lane[l].message = 0;
+		for (;;) {
+			for (unsigned l = 0;l < lanes;++l) {
+				if (lane[l].message || next >= count) continue;
+				lane[l].message = messages + next++;
+				lane[l].pos = 0;
+				lane[l].steps_left = 0;
+				for (unsigned i = 0;i < CubeHashRound::STATE_WORDS;++i) x[i * lanes + l] = iv[i];
+				++busy;
+			}
+			if (!busy) break;
+			for (unsigned l = 0;l < lanes;++l) {
+				if (!lane[l].message || lane[l].steps_left) continue;
+				const Message & msg(*lane[l].message);
+				const std::size_t remaining(msg.length - lane[l].pos);
+				if (remaining >= bytes_per_block) {
+					for (unsigned i = 0;i < words_per_block;++i)
+						x[i * lanes + l] ^= CubeHashRound::load_le32(msg.data + lane[l].pos + 4U * i);
+					lane[l].pos += bytes_per_block;
+				} else {
+					unsigned char last[bytes_per_block];
+					std::memset(last, 0, sizeof last);
+					if (remaining) std::memcpy(last, msg.data + lane[l].pos, remaining);
+					last[remaining] = 128U;
+					for (unsigned i = 0;i < words_per_block;++i)
+						x[i * lanes + l] ^= CubeHashRound::load_le32(last + 4U * i);
+					lane[l].pos = msg.length;
+					lane[l].steps_left = 1U + F / R;
+				}
+			}
+			m.function(x, R);
+			for (unsigned l = 0;l < lanes;++l) {
+				if (!lane[l].message || !lane[l].steps_left) continue;
+				if (F / R == --lane[l].steps_left)
+					x[31U * lanes + l] ^= 1U;
+				if (!lane[l].steps_left) {
+					for (unsigned i = 0;i < hashbytelen;++i)
+						lane[l].message->hashval[i] = static_cast<unsigned char>(x[(i / 4U) * lanes + l] >> (8U * (i % 4U)));
+					lane[l].message = 0;
+					--busy;
+				}
+			}
+		}
+	}
+
+protected:
+	// Running the final rounds in whole steps requires that they be a multiple of the block rounds.
+	typedef char final_rounds_multiple_of_block_rounds[(0U == F % R) ? 1 : -1];
+
+	struct Lane {
+		Message * message;	///< null if the lane is idle
+		std::size_t pos;	///< number of bytes of the message absorbed so far
+		unsigned int steps_left;	///< non-zero once the final block has been absorbed
+	};
+};
+
+typedef MultiBufferCubeHash<16U, 16U, 32U, 32U, 256U> MultiBufferCubeHashSHA3AHS256;
@@ -0,0 +1,458 @@
+#include <stdint.h>
+#include <cstddef>
+#include <cstring>
+
+/* XXH3-128 *****************************************************************
+// **************************************************************************
+*/
+
+// This is Yann Collet's XXH3 non-cryptographic hash, in its 128-bit form, with the default secret and a seed of zero.
+// It produces the same values as XXH3_128bits() of xxHash 0.8, but it is a from-scratch scalar implementation.
+
+namespace XXH3Internals {
+
+	enum {
+		STRIPE_LEN = 64,
+		SECRET_SIZE = 192,
+		SECRET_CONSUME_RATE = 8,
+		ACC_NB = 8,
+		STRIPES_PER_BLOCK = (SECRET_SIZE - STRIPE_LEN) / SECRET_CONSUME_RATE,
+		BLOCK_LEN = STRIPE_LEN * STRIPES_PER_BLOCK,
+		MIDSIZE_MAX = 240,
+		MIDSIZE_STARTOFFSET = 3,
+		MIDSIZE_LASTOFFSET = 17,
+		SECRET_SIZE_MIN = 136,
+		SECRET_LASTACC_START = 7,
+		SECRET_MERGEACCS_START = 11
+	};
+
+	static const uint32_t PRIME32_1 = 0x9E3779B1U;
+	static const uint32_t PRIME32_2 = 0x85EBCA77U;
+	static const uint32_t PRIME32_3 = 0xC2B2AE3DU;
+	static const uint64_t PRIME64_1 = 0x9E3779B185EBCA87ULL;
+	static const uint64_t PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+	static const uint64_t PRIME64_3 = 0x165667B19E3779F9ULL;
+	static const uint64_t PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+	static const uint64_t PRIME64_5 = 0x27D4EB2F165667C5ULL;
+	static const uint64_t PRIME_MX1 = 0x165667919E3779F9ULL;
+	static const uint64_t PRIME_MX2 = 0x9FB21C651E98DF25ULL;
+
+	static const unsigned char secret[SECRET_SIZE] = {
+		0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+		0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+		0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+		0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+		0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+		0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+		0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+		0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+		0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+		0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+		0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+		0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+	};
+
+	struct uint128 {
+		uint64_t low64, high64;
+	};
+
+	static inline
+	uint32_t
+	read32 (
+		const unsigned char * p
+	) {
+		return uint32_t(p[0]) | (uint32_t(p[1]) << 8U) | (uint32_t(p[2]) << 16U) | (uint32_t(p[3]) << 24U);
+	}
+
+	static inline
+	uint64_t
+	read64 (
+		const unsigned char * p
+	) {
+#if defined(__BYTE_ORDER__) && defined(__ORDER_LITTLE_ENDIAN__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+		uint64_t w;
+		std::memcpy(&w, p, sizeof w);
+		return w;
+#else
+		return uint64_t(read32(p)) | (uint64_t(read32(p + 4)) << 32U);
+#endif
+	}
+
+	static inline uint32_t rotl32(uint32_t x, unsigned r) { return (x << r) | (x >> (32U - r)); }
+	static inline uint64_t rotl64(uint64_t x, unsigned r) { return (x << r) | (x >> (64U - r)); }
+	static inline uint32_t swap32(uint32_t x) { return (x << 24U) | ((x << 8U) & 0x00FF0000U) | ((x >> 8U) & 0x0000FF00U) | (x >> 24U); }
+	static inline uint64_t swap64(uint64_t x) { return (uint64_t(swap32(uint32_t(x))) << 32U) | swap32(uint32_t(x >> 32U)); }
+	static inline uint64_t xorshift64(uint64_t v, unsigned s) { return v ^ (v >> s); }
+
+	static inline
+	uint128
+	mult64to128 (
+		uint64_t lhs,
+		uint64_t rhs
+	) {
+		uint128 r;
+#if defined(__SIZEOF_INT128__)
+		const unsigned __int128 product(static_cast<unsigned __int128>(lhs) * rhs);
+		r.low64 = static_cast<uint64_t>(product);
+		r.high64 = static_cast<uint64_t>(product >> 64U);
+#else
+		const uint64_t lo_lo((lhs & 0xFFFFFFFFU) * (rhs & 0xFFFFFFFFU));
+		const uint64_t hi_lo((lhs >> 32U) * (rhs & 0xFFFFFFFFU));
+		const uint64_t lo_hi((lhs & 0xFFFFFFFFU) * (rhs >> 32U));
+		const uint64_t hi_hi((lhs >> 32U) * (rhs >> 32U));
+		const uint64_t cross((lo_lo >> 32U) + (hi_lo & 0xFFFFFFFFU) + lo_hi);
+		r.high64 = (hi_lo >> 32U) + (cross >> 32U) + hi_hi;
+		r.low64 = (cross << 32U) | (lo_lo & 0xFFFFFFFFU);
+#endif
+		return r;
+	}
+
+	static inline
+	uint64_t
+	mul128_fold64 (
+		uint64_t lhs,
+		uint64_t rhs
+	) {
+		const uint128 product(mult64to128(lhs, rhs));
+		return product.low64 ^ product.high64;
+	}
+
+	static inline
+	uint64_t
+	xxh64_avalanche (
+		uint64_t h
+	) {
+		h ^= h >> 33U;
+		h *= PRIME64_2;
+		h ^= h >> 29U;
+		h *= PRIME64_3;
+		h ^= h >> 32U;
+		return h;
+	}
+
+	static inline
+	uint64_t
+	avalanche (
+		uint64_t h
+	) {
+		h = xorshift64(h, 37U);
+		h *= PRIME_MX1;
+		h = xorshift64(h, 32U);
+		return h;
+	}
+
+	static inline
+	uint64_t
+	mix16B (
+		const unsigned char * input,
+		const unsigned char * s
+	) {
+		return mul128_fold64(read64(input) ^ read64(s), read64(input + 8) ^ read64(s + 8));
+	}
+
+	static inline
+	void
+	mix32B (
+		uint128 & acc,
+		const unsigned char * input_1,
+		const unsigned char * input_2,
+		const unsigned char * s
+	) {
+		acc.low64 += mix16B(input_1, s);
+		acc.low64 ^= read64(input_2) + read64(input_2 + 8);
+		acc.high64 += mix16B(input_2, s + 16);
+		acc.high64 ^= read64(input_1) + read64(input_1 + 8);
+	}
+
+	static inline
+	uint128
+	len_0 ()
+	{
+		uint128 h;
+		h.low64 = xxh64_avalanche(read64(secret + 64) ^ read64(secret + 72));
+		h.high64 = xxh64_avalanche(read64(secret + 80) ^ read64(secret + 88));
+		return h;
+	}
+
+	static inline
+	uint128
+	len_1to3 (
+		const unsigned char * input,
+		std::size_t len
+	) {
+		const uint32_t c1(input[0]), c2(input[len >> 1U]), c3(input[len - 1U]);
+		const uint32_t combinedl((c1 << 16U) | (c2 << 24U) | (c3 << 0U) | (uint32_t(len) << 8U));
+		const uint32_t combinedh(rotl32(swap32(combinedl), 13U));
+		const uint64_t bitflipl(read32(secret) ^ read32(secret + 4));
+		const uint64_t bitfliph(read32(secret + 8) ^ read32(secret + 12));
+		uint128 h;
+		h.low64 = xxh64_avalanche(uint64_t(combinedl) ^ bitflipl);
+		h.high64 = xxh64_avalanche(uint64_t(combinedh) ^ bitfliph);
+		return h;
+	}
+
+	static inline
+	uint128
+	len_4to8 (
+		const unsigned char * input,
+		std::size_t len
+	) {
+		const uint64_t input_64(read32(input) + (uint64_t(read32(input + len - 4U)) << 32U));
+		const uint64_t bitflip(read64(secret + 16) ^ read64(secret + 24));
+		uint128 m(mult64to128(input_64 ^ bitflip, PRIME64_1 + (uint64_t(len) << 2U)));
+		m.high64 += m.low64 << 1U;
+		m.low64 ^= m.high64 >> 3U;
+		m.low64 = xorshift64(m.low64, 35U);
+		m.low64 *= PRIME_MX2;
+		m.low64 = xorshift64(m.low64, 28U);
+		m.high64 = avalanche(m.high64);
+		return m;
+	}
+
+	static inline
+	uint128
+	len_9to16 (
+		const unsigned char * input,
+		std::size_t len
+	) {
+		const uint64_t bitflipl(read64(secret + 32) ^ read64(secret + 40));
+		const uint64_t bitfliph(read64(secret + 48) ^ read64(secret + 56));
+		const uint64_t input_lo(read64(input));
+		uint64_t input_hi(read64(input + len - 8U));
+		uint128 m(mult64to128(input_lo ^ input_hi ^ bitflipl, PRIME64_1));
+		m.low64 += uint64_t(len - 1U) << 54U;
+		input_hi ^= bitfliph;
+		m.high64 += input_hi + uint64_t(uint32_t(input_hi)) * (PRIME32_2 - 1U);
+		m.low64 ^= swap64(m.high64);
+		uint128 h(mult64to128(m.low64, PRIME64_2));
+		h.high64 += m.high64 * PRIME64_2;
+		h.low64 = avalanche(h.low64);
+		h.high64 = avalanche(h.high64);
+		return h;
+	}
+
+	static inline
+	uint128
+	finish_mid (
+		const uint128 & acc,
+		std::size_t len
+	) {
+		uint128 h;
+		h.low64 = acc.low64 + acc.high64;
+		h.high64 = (acc.low64 * PRIME64_1) + (acc.high64 * PRIME64_4) + (uint64_t(len) * PRIME64_2);
+		h.low64 = avalanche(h.low64);
+		h.high64 = 0U - avalanche(h.high64);
+		return h;
+	}
+
+	static inline
+	uint128
+	len_17to128 (
+		const unsigned char * input,
+		std::size_t len
+	) {
+		uint128 acc;
+		acc.low64 = uint64_t(len) * PRIME64_1;
+		acc.high64 = 0U;
+		if (len > 32U) {
+			if (len > 64U) {
+				if (len > 96U)
+					mix32B(acc, input + 48, input + len - 64U, secret + 96);
+				mix32B(acc, input + 32, input + len - 48U, secret + 64);
+			}
+			mix32B(acc, input + 16, input + len - 32U, secret + 32);
+		}
+		mix32B(acc, input, input + len - 16U, secret);
+		return finish_mid(acc, len);
+	}
+
+	static inline
+	uint128
+	len_129to240 (
+		const unsigned char * input,
+		std::size_t len
+	) {
+		const unsigned rounds(static_cast<unsigned>(len / 32U));
+		uint128 acc;
+		acc.low64 = uint64_t(len) * PRIME64_1;
+		acc.high64 = 0U;
+		for (unsigned i = 0;i < 4U;++i)
+			mix32B(acc, input + 32U * i, input + 32U * i + 16U, secret + 32U * i);
+		acc.low64 = avalanche(acc.low64);
+		acc.high64 = avalanche(acc.high64);
+		for (unsigned i = 4;i < rounds;++i)
+			mix32B(acc, input + 32U * i, input + 32U * i + 16U, secret + MIDSIZE_STARTOFFSET + 32U * (i - 4U));
+		mix32B(acc, input + len - 16U, input + len - 32U, secret + SECRET_SIZE_MIN - MIDSIZE_LASTOFFSET - 16);
+		return finish_mid(acc, len);
+	}
+
+	static inline
+	uint128
+	short_input (
+		const unsigned char * input,
+		std::size_t len
+	) {
+		if (len <= 16U) {
+			if (len > 8U) return len_9to16(input, len);
+			if (len >= 4U) return len_4to8(input, len);
+			if (len) return len_1to3(input, len);
+			return len_0();
+		}
+		if (len <= 128U) return len_17to128(input, len);
+		return len_129to240(input, len);
+	}
+
+	static inline
+	void
+	accumulate_512 (
+		uint64_t acc[ACC_NB],
+		const unsigned char * input,
+		const unsigned char * s
+	) {
+		for (unsigned i = 0;i < ACC_NB;++i) {
+			const uint64_t data_val(read64(input + 8U * i));
+			const uint64_t data_key(data_val ^ read64(s + 8U * i));
+			acc[i ^ 1U] += data_val;
+			acc[i] += uint64_t(uint32_t(data_key)) * (data_key >> 32U);
+		}
+	}
+
+	static inline
+	void
+	scramble (
+		uint64_t acc[ACC_NB],
+		const unsigned char * s
+	) {
+		for (unsigned i = 0;i < ACC_NB;++i) {
+			uint64_t a(acc[i]);
+			a = xorshift64(a, 47U);
+			a ^= read64(s + 8U * i);
+			a *= PRIME32_1;
+			acc[i] = a;
+		}
+	}
+
+	static inline
+	uint64_t
+	merge_accs (
+		const uint64_t acc[ACC_NB],
+		const unsigned char * s,
+		uint64_t start
+	) {
+		uint64_t result(start);
+		for (unsigned i = 0;i < 4U;++i)
+			result += mul128_fold64(acc[2U * i] ^ read64(s + 16U * i), acc[2U * i + 1U] ^ read64(s + 16U * i + 8U));
+		return avalanche(result);
+	}
+
+}
+
+/// \brief Incremental XXH3-128
+///
+/// Input is buffered only so far as is needed to ensure that the final stripe is never consumed before it is known to be the final stripe.
+/// Inputs of up to 240 bytes are hashed on completion by the special-purpose short input code.
+class XXH3_128 {
+public:
+	unsigned char hashval[16];	///< the canonical (big-endian) form
+
+	XXH3_128() :
+		total_len(0),
+		buffered(0),
+		stripes_in_block(0)
+	{
+		acc[0] = XXH3Internals::PRIME32_3;
+		acc[1] = XXH3Internals::PRIME64_1;
+		acc[2] = XXH3Internals::PRIME64_2;
+		acc[3] = XXH3Internals::PRIME64_3;
+		acc[4] = XXH3Internals::PRIME64_4;
+		acc[5] = XXH3Internals::PRIME32_2;
+		acc[6] = XXH3Internals::PRIME64_5;
+		acc[7] = XXH3Internals::PRIME32_1;
+	}
+
+	void Update(const unsigned char *data, std::size_t len)
+	{
+		total_len += len;
+		if (buffered + len <= BUFFER_SIZE) {
+			if (len) std::memcpy(buffer + buffered, data, len);
+			buffered += len;
+			return;
+		}
+		if (buffered) {
+			const std::size_t fill(BUFFER_SIZE - buffered);
+			std::memcpy(buffer + buffered, data, fill);
+			data += fill;
+			len -= fill;
+			consume_stripes(buffer, BUFFER_SIZE / XXH3Internals::STRIPE_LEN);
+			buffered = 0;
+		}
+		if (len > BUFFER_SIZE) {
+			do {
+				consume_stripes(data, BUFFER_SIZE / XXH3Internals::STRIPE_LEN);
+				data += BUFFER_SIZE;
+				len -= BUFFER_SIZE;
+			} while (len > BUFFER_SIZE);
+			// The final stripe might need to reach back into this data.
+			std::memcpy(buffer + BUFFER_SIZE - XXH3Internals::STRIPE_LEN, data - XXH3Internals::STRIPE_LEN, XXH3Internals::STRIPE_LEN);
+		}
+		std::memcpy(buffer, data, len);
+		buffered = len;
+	}
+
+	void Final()
+	{
+		XXH3Internals::uint128 h;
+		if (total_len <= XXH3Internals::MIDSIZE_MAX)
+			h = XXH3Internals::short_input(buffer, static_cast<std::size_t>(total_len));
+		else {
+			uint64_t a[XXH3Internals::ACC_NB];
+			std::memcpy(a, acc, sizeof a);
+			unsigned stripes(stripes_in_block);
+			const unsigned char * last_stripe;
+			unsigned char joined[XXH3Internals::STRIPE_LEN];
+			if (buffered >= XXH3Internals::STRIPE_LEN) {
+				const std::size_t n((buffered - 1U) / XXH3Internals::STRIPE_LEN);
+				for (std::size_t i = 0;i < n;++i) {
+					XXH3Internals::accumulate_512(a, buffer + XXH3Internals::STRIPE_LEN * i, XXH3Internals::secret + XXH3Internals::SECRET_CONSUME_RATE * stripes);
+					if (++stripes == XXH3Internals::STRIPES_PER_BLOCK) {
+						XXH3Internals::scramble(a, XXH3Internals::secret + XXH3Internals::SECRET_SIZE - XXH3Internals::STRIPE_LEN);
+						stripes = 0;
+					}
+				}
+				last_stripe = buffer + buffered - XXH3Internals::STRIPE_LEN;
+			} else {
+				const std::size_t from_previous(XXH3Internals::STRIPE_LEN - buffered);
+				std::memcpy(joined, buffer + BUFFER_SIZE - from_previous, from_previous);
+				std::memcpy(joined + from_previous, buffer, buffered);
+				last_stripe = joined;
+			}
+			XXH3Internals::accumulate_512(a, last_stripe, XXH3Internals::secret + XXH3Internals::SECRET_SIZE - XXH3Internals::STRIPE_LEN - XXH3Internals::SECRET_LASTACC_START);
+			h.low64 = XXH3Internals::merge_accs(a, XXH3Internals::secret + XXH3Internals::SECRET_MERGEACCS_START, total_len * XXH3Internals::PRIME64_1);
+			h.high64 = XXH3Internals::merge_accs(a, XXH3Internals::secret + XXH3Internals::SECRET_SIZE - sizeof a - XXH3Internals::SECRET_MERGEACCS_START, ~(total_len * XXH3Internals::PRIME64_2));
+		}
+		for (unsigned i = 0;i < 8U;++i) {
+			hashval[i] = static_cast<unsigned char>(h.high64 >> (56U - 8U * i));
+			hashval[8U + i] = static_cast<unsigned char>(h.low64 >> (56U - 8U * i));
+		}
+	}
+
+protected:
+	enum { BUFFER_SIZE = 4 * XXH3Internals::STRIPE_LEN };
+	uint64_t acc[XXH3Internals::ACC_NB];
+	uint64_t total_len;
+	std::size_t buffered;
+	unsigned stripes_in_block;
+	unsigned char buffer[BUFFER_SIZE];
+
+	// Only ever called when more input is known to follow the stripes.
+	void consume_stripes(const unsigned char * p, std::size_t n)
+	{
+		for (std::size_t i = 0;i < n;++i) {
+			XXH3Internals::accumulate_512(acc, p + XXH3Internals::STRIPE_LEN * i, XXH3Internals::secret + XXH3Internals::SECRET_CONSUME_RATE * stripes_in_block);
+			if (++stripes_in_block == XXH3Internals::STRIPES_PER_BLOCK) {
+				XXH3Internals::scramble(acc, XXH3Internals::secret + XXH3Internals::SECRET_SIZE - XXH3Internals::STRIPE_LEN);
+				stripes_in_block = 0;
+			}
+		}
+	}
+};
@@ -0,0 +1,74 @@
+/* COPYING ******************************************************************
+For copyright and licensing terms, see the file named COPYING.
+// **************************************************************************
+*/
+
+// A micro-benchmark of reading text-format databases, which is not part of the package.
+// It is built and run by package/bench, and measures the parser that redo itself uses, by compiling in the whole of redo with its main() renamed out of the way.
+
+#define main redo_main
+#include "redo.cpp"
+#undef main
+
+/// Write a text database of the given number of lines, in the form that older versions of redo left behind.
+static
+bool
+write_text_database (
+	const char * filename,
+	unsigned long lines
+) {
+	std::ofstream s(filename, std::ios::binary|std::ios::trunc);
+	if (s.fail()) return false;
+	s << "h" << hash_algorithm_names[CUBEHASH] << "\n";
+	Information info;
+	info.type = info.FILE;
+	info.hash_algorithm = CUBEHASH;
+	info.has_fingerprint = true;
+	for (unsigned long j(0); j < lines; ++j) {
+		for (std::size_t k(0); k < sizeof info.hash; ++k)
+			info.hash[k] = static_cast<unsigned char>((j * 31U + k * 7U) & 0xFFU);
+		info.last_written = static_cast<std::time_t>(1700000000L + j);
+		info.last_written_nsec = static_cast<long>((j * 7919UL) % 1000000000UL);
+		info.size = 1000U + j % 65536U;
+		info.inode = 7000000U + j;
+		std::ostringstream name;
+		name << "src/dir" << j % 100U << "/file" << j << ".c";
+		write_db_line(s, info, name.str().c_str());
+	}
+	return !s.fail();
+}
+
+int
+main ( int argc, const char * argv[] )
+{
+	const char * prog(basename_of(argv[0]));
+	const char * filename(argc > 1 ? argv[1] : "dbbench.prereqs");
+	const unsigned long lines(argc > 2 ? std::strtoul(argv[2], 0, 0) : 200000UL);
+	enum { RUNS = 7 };
+
+	if (!write_text_database(filename, lines)) {
+		const int error(errno);
+		msg(prog, "ERROR") << filename << ": " << std::strerror(error) << "\n";
+		return EXIT_FAILURE;
+	}
+	double best(0.0);
+	unsigned long records(0);
+	for (int run(0); run < RUNS; ++run) {
+		const double start(monotonic_seconds());
+		DatabaseReader db(filename, DatabaseReader::FILE_NAME);
+		Information info;
+		const char * name;
+		std::size_t name_length;
+		records = 0;
+		while (db.next(info, name, name_length))
+			++records;
+		const double elapsed(monotonic_seconds() - start);
+		if (0 == run || elapsed < best) best = elapsed;
+	}
+	std::remove(filename);
+	std::cout << records << " records, best of " << RUNS << " runs " << best << " seconds";
+	if (best > 0.0)
+		std::cout << " (" << static_cast<unsigned long long>(static_cast<double>(records) / best) << " lines/s)";
+	std::cout << ".\n";
+	return records == lines ? EXIT_SUCCESS : EXIT_FAILURE;
+}
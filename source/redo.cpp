@@ -6,13 +6,18 @@ For copyright and licensing terms, see the file named COPYING.
 #include <string>
 #include <list>
 #include <map>
+#include <deque>
+#include <queue>
+#include <set>
 #include <vector>
+#include <iterator>
 #include <iostream>
 #include <iomanip>
 #include <fstream>
 #include <sstream>
 #include <cassert>
 #include <cctype>
+#include <cstddef>
 #include <cstring>
 #include <cstdio>
 #include <cstdlib>
@@ -24,15 +29,30 @@ For copyright and licensing terms, see the file named COPYING.
 #include <unistd.h>
 #include <fcntl.h>
 #include <poll.h>
+#include <dirent.h>
 #if defined(__OS2__) || defined(__WIN32__) || defined(__NT__)
 #include <direct.h>	// for mkdir()
 #include <process.h>	// for spawn()
 #else
 #include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
 #include <ftw.h>
+#include <csignal>
+#include <csetjmp>
+#include <pthread.h>
+#include <sys/socket.h>
+#endif
+#if defined(__linux__)
+#include <sys/inotify.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <sched.h>
 #endif
 #include "popt.h"
 #include "CubeHash.h"
+#include "XXH3.h"
 #if defined(__unix__) || defined(__UNIX__) || (defined(__APPLE__) && defined(__MACH__)) || defined(__INTERIX)
 extern "C" char ** environ;
 #endif
@@ -64,13 +84,37 @@ public:
 	}
 };
 
+/// A long option whose argument can either follow it or be attached to it with an equals sign, as GNU programs allow.
+struct equals_string_definition : public popt::string_definition {
+public:
+	equals_string_definition(char s, const char * l, const char * a, const char * d, const char * & v) : string_definition(s, l, a, d, v) {}
+	using popt::string_definition::execute;
+	virtual bool execute(popt::processor & proc, const char * s)
+	{
+		if (const char * long_name = query_long_name()) {
+			const std::size_t len(std::strlen(long_name));
+			if (0 == std::strncmp(long_name, s, len) && '=' == s[len]) {
+				value = s + len + 1;
+				return true;
+			}
+		}
+		return string_definition::execute(proc, s);
+	}
+};
+
 enum { MAX_META_DEPTH = 1U };
 static bool keep_going(false);
 static bool debug(false);
 static bool silent(false);
 static bool verbose(false);
-static int jobserver_fds[2] = { -1, -1 };
+static int jobserver_fds[2] = { -1, -1 };	///< both the same descriptor when the jobserver is a named FIFO
+static std::string jobserver_fifo;	///< the name of the jobserver FIFO, if it is one
+static char * jobserver_fifo_to_remove = 0;	///< the name of the jobserver FIFO, if this process created it, in a form that a signal handler can use
+static pid_t jobserver_fifo_owner = 0;	///< so that forked processes that do not exec do not remove it
 static int redoparent_fd = -1;
+static int file_info_server_fd = -1;
+static unsigned long max_memory_mib = 0;	///< 0 for no limit
+static double max_load_average = 0.0;	///< 0 for no limit
 static std::string makelevel;
 
 static
@@ -172,6 +216,52 @@ posix_lstat (
 #endif
 }
 
+static inline
+long
+mtime_nsec (
+	const struct stat & s
+) {
+#if defined(__APPLE__) && defined(__MACH__)
+	return s.st_mtimespec.tv_nsec;
+#elif defined(__linux__) || defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__) || defined(__DragonFly__) || defined(_ATFILE_SOURCE)
+	return s.st_mtim.tv_nsec;
+#else
+	static_cast<void>(s);
+	return 0L;
+#endif
+}
+
+static inline
+long
+ctime_nsec (
+	const struct stat & s
+) {
+#if defined(__APPLE__) && defined(__MACH__)
+	return s.st_ctimespec.tv_nsec;
+#elif defined(__linux__) || defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__) || defined(__DragonFly__) || defined(_ATFILE_SOURCE)
+	return s.st_ctim.tv_nsec;
+#else
+	static_cast<void>(s);
+	return 0L;
+#endif
+}
+
+/// Whether two stat() results denote the same, unmodified, version of a file.
+static inline
+bool
+same_file_version (
+	const struct stat & a,
+	const struct stat & b
+) {
+	return a.st_dev == b.st_dev
+	&&     a.st_ino == b.st_ino
+	&&     a.st_size == b.st_size
+	&&     a.st_mtime == b.st_mtime
+	&&     mtime_nsec(a) == mtime_nsec(b)
+	&&     a.st_ctime == b.st_ctime
+	&&     ctime_nsec(a) == ctime_nsec(b);
+}
+
 static inline
 int
 posix_mkdir (
@@ -270,18 +360,6 @@ makepath (
 // **************************************************************************
 */
 
-static inline
-int
-x2d (
-	char c
-) {
-	if (!std::isxdigit(c)) return -1;
-	if (std::isdigit(c)) return c - '0';
-	if (std::isupper(c)) return c - 'A' + 10;
-	if (std::islower(c)) return c - 'a' + 10;
-	return -1;
-}
-
 static inline
 std::list<std::string>
 split(
@@ -329,863 +407,4835 @@ convert (
 	return v;
 }
 
-/* struct Information and the cache of directory entry information **********
-// **************************************************************************
-*/
-
-struct Information {
-	enum { NOTHING, SPECIAL, DIRECTORY, FILE } type;
-	std::time_t last_written;
-	unsigned char hash[32];		// 256 bits
-};
-
+/// The FNV-1a hash of some bytes, continuing from an earlier hash if one is given.
+/// It serves both for hashing names into tables and as the checksum of the records in .redo.
 static inline
-Information
-read_file_info (
-	const std::string & name,
-	const Information * old_info
-) {
-	Information i;
-	struct stat stbuf;
-	if (0 > posix_lstat(name.c_str(), &stbuf)) {
-		i.type = i.NOTHING;
-		i.last_written = -1;
-		for ( std::size_t j(0);j < sizeof i.hash/sizeof *i.hash; ++j)
-			i.hash[j] = 0;
-	} else {
-		i.last_written = stbuf.st_mtime;
-		if (S_ISREG(stbuf.st_mode)) {
-			i.type = i.FILE;
-			if (old_info && old_info->last_written == i.last_written) {
-				memmove(i.hash, old_info->hash, sizeof i.hash);
-			} else {
-				// This is Dan Bernstein's SHA-3-AHS256 proposal from 2010-11.
-				CubeHash h(16U, 16U, 32U, 32U, 8U * sizeof i.hash/sizeof *i.hash);
-				std::ifstream f(name.c_str(), std::ios::binary);
-				if (!f.fail()) {
-					char buf[4096];
-					for (;;) {
-						f.read(buf, sizeof buf);
-						h.Update(reinterpret_cast<unsigned char *>(buf), static_cast<std::size_t>(f.gcount()));
-						if (f.eof()) break;
-					}
-				}
-				h.Final();
-				for ( std::size_t j(0);j < sizeof i.hash/sizeof *i.hash; ++j)
-					i.hash[j] = h.hashval[j];
-			}
-		} else {
-			if (S_ISDIR(stbuf.st_mode))
-				i.type = i.DIRECTORY;
-			else
-				i.type = i.SPECIAL;
-			for ( std::size_t j(0);j < sizeof i.hash/sizeof *i.hash; ++j)
-				i.hash[j] = 0;
-		}
-	}
-	return i;
-}
-
-typedef std::map<std::string, Information> InfoMap;
-static InfoMap file_info_map;
-
-static
-Information &
-get_file_info (
-	const std::string & name,
-	const Information * old_info
+uint32_t
+fnv1a (
+	const void * p,
+	std::size_t len,
+	uint32_t h = 2166136261U
 ) {
-	InfoMap::iterator f(file_info_map.find(name));
-	if (f == file_info_map.end())
-		f = file_info_map.insert(InfoMap::value_type(name, read_file_info(name, old_info))).first;
-	return f->second;
+	const unsigned char * b(static_cast<const unsigned char *>(p));
+	for (std::size_t j(0); j < len; ++j)
+		h = (h ^ b[j]) * 16777619U;
+	return h;
 }
 
 static inline
-void
-delete_file_info (
-	const std::string & name
+uint64_t
+fnv1a_64 (
+	const void * p,
+	std::size_t len
 ) {
-	file_info_map.erase(name);
+	const unsigned char * b(static_cast<const unsigned char *>(p));
+	uint64_t h(14695981039346656037ULL);
+	for (std::size_t j(0); j < len; ++j)
+		h = (h ^ b[j]) * 1099511628211ULL;
+	return h;
 }
 
-/* Parsing and updating of the .redo database *******************************
+/* Interned path names ******************************************************
 // **************************************************************************
 */
 
-static inline
-void
-read_db_line (
-	std::istream & s,
-	Information & i,
-	std::string & name
+// Every path name that redo deals with is canonicalized and stored once, in an arena, and thereafter referred to by a small integer.
+// Canonicalization is lexical: empty and "." components are removed, and ".." removes the preceding component, so that ./a, a, and dir/../a are all the same name.
+typedef uint32_t PathID;
+
+class PathTable {
+public:
+	PathTable() : slots(1024U, NO_PATH), block_used(0) {}
+	PathID intern(const char *, std::size_t);
+	PathID intern(const char * s) { return intern(s, std::strlen(s)); }
+	PathID intern(const std::string & s) { return intern(s.data(), s.length()); }
+	const char * name(PathID id) const { return names[id]; }
+	std::size_t length(PathID id) const { return lengths[id]; }
+	std::string str(PathID id) const { return std::string(names[id], lengths[id]); }
+protected:
+	enum { NO_PATH = 0xFFFFFFFFU, BLOCK_SIZE = 65536U };
+	std::vector<PathID> slots;	///< open addressing with linear probing, kept at most half full
+	std::vector<const char *> names;
+	std::vector<uint32_t> lengths, hashes;
+	std::list<std::vector<char> > blocks;
+	std::size_t block_used;
+	std::string scratch;
+	std::vector<std::size_t> starts;
+	static uint32_t hash(const char *, std::size_t);
+	static bool is_separator(char c);
+	void canonicalize(const char *, std::size_t);
+	const char * store(const char *, std::size_t);
+	void grow();
+};
+
+uint32_t
+PathTable::hash(
+	const char * p,
+	std::size_t len
 ) {
-	switch (int c = s.get()) {
-		default:
-		case EOF:
-		case 'a':
-			i.type = i.NOTHING;
-			break;
-		case 's':
-			i.type = i.SPECIAL;
-			goto atime;
-		case 'd':
-			i.type = i.DIRECTORY;
-			goto atime;
-		case 'f':
-			i.type = i.FILE;
-			goto cksum;
-		cksum:
-		{
-#if defined(__WATCOMC__)
-			s.setf(s.skipws);
-			s.ipfx(0);
-#else
-			s >> std::skipws;
-			std::istream::sentry ipfx(s, /*noskipws=*/false);
-#endif
-			for ( std::size_t j(0);j < sizeof i.hash/sizeof *i.hash; ++j) {
-				char two[2];
-				s.read(two, 2);
-				i.hash[j] = static_cast<unsigned char>(x2d(two[0]) << 4) + static_cast<unsigned char>(x2d(two[1]));
-			}
-#if defined(__WATCOMC__)
-			s.isfx();
-			s.unsetf(s.skipws);
-#else
-			s >> std::noskipws;
-#endif
-		}
-		atime:
-#if defined(__WATCOMC__)
-			s.setf(s.skipws);
-#else
-			s >> std::skipws;
-#endif
-			s >> std::hex >> i.last_written >> std::dec;
-#if defined(__WATCOMC__)
-			s.unsetf(s.skipws);
-#else
-			s >> std::noskipws;
-#endif
-			break;
-		// FIXME: Delete this special case once we switch to the new .redo database filenames.
-		case '\n':
-		case '\t':
-		case '\f':
-		case '\b':
-		case '\v':
-		case '\r':
-		case ' ':
-		{
-			char md5sum[128/8];
-			i.type = i.FILE;
-#if defined(__WATCOMC__)
-			s.setf(s.skipws);
+	return fnv1a(p, len);
+}
+
+bool
+PathTable::is_separator(
+	char c
+) {
+#if defined(__OS2__) || defined(__WIN32__) || defined(__NT__)
+	return '/' == c || '\\' == c;
 #else
-			s >> std::skipws;
+	return '/' == c;
 #endif
-			s >> name >> std::hex >> i.last_written >> std::dec;
-			for (std::size_t j(0); j < sizeof md5sum/sizeof *md5sum; ++j) {
-				char two[2];
-				s.read(two, 2);
-				md5sum[j] = static_cast<char>(x2d(two[0]) << 4) + static_cast<char>(x2d(two[1]));
-			}
-#if defined(__WATCOMC__)
-			s.unsetf(s.skipws);
-#else
-			s >> std::noskipws;
+}
+
+/// Canonicalize the name into scratch.
+void
+PathTable::canonicalize(
+	const char * p,
+	std::size_t len
+) {
+	scratch.clear();
+	starts.clear();
+#if defined(__OS2__) || defined(__WIN32__) || defined(__NT__)
+	if (len >= 2 && std::isalpha(p[0]) && ':' == p[1]) {
+		scratch.append(p, 2);
+		p += 2;
+		len -= 2;
+	}
 #endif
-			return;
+	const bool absolute(len > 0 && is_separator(p[0]));
+	const bool trailing(len > 1 && is_separator(p[len - 1]));
+	if (absolute) scratch += p[0];
+	const std::size_t root(scratch.length());
+	for (std::size_t j(0); j < len; ) {
+		std::size_t k(j);
+		while (k < len && !is_separator(p[k])) ++k;
+		const std::size_t n(k - j);
+		const bool dotdot(2 == n && '.' == p[j] && '.' == p[j + 1]);
+		if (0 == n || (1 == n && '.' == p[j])) {
+			// Empty and "." components are dropped.
+		} else
+		if (dotdot && !starts.empty() && 0 != scratch.compare(starts.back(), std::string::npos, "..")) {
+			scratch.resize(starts.back() > root ? starts.back() - 1 : root);
+			starts.pop_back();
+		} else
+		if (!(dotdot && absolute && starts.empty())) {
+			if (scratch.length() > root) scratch += '/';
+			starts.push_back(scratch.length());
+			scratch.append(p + j, n);
 		}
+		j = k + 1;
 	}
-	while (!s.eof() && std::isspace(s.peek()))
-		s.get();
-	char namebuf[PATH_MAX];
-	s.getline(namebuf, sizeof namebuf);
-	name = namebuf;
+	if (scratch.length() == root) {
+		if (!absolute) scratch += '.';
+	} else
+	if (trailing)
+		scratch += '/';
 }
 
-static inline
-void
-write_db_line (
-	std::ostream & s,
-	const Information & info,
-	const char * name
+const char *
+PathTable::store(
+	const char * p,
+	std::size_t len
 ) {
-	switch (info.type) {
-		case Information::NOTHING:	s.put('a') << name << '\n'; break;
-		case Information::SPECIAL:	s.put('s') << std::hex << info.last_written << ' ' << std::dec << name << '\n'; break;
-		case Information::DIRECTORY:	s.put('d') << std::hex << info.last_written << ' ' << std::dec << name << '\n'; break;
-		case Information::FILE:
-			s.put('f') << std::hex << std::setfill('0');
-			for ( std::size_t j(0);j < (sizeof info.hash/sizeof *info.hash); ++j)
-				s << std::setw(2) << static_cast<unsigned int>(info.hash[j]);
-			s << ' ' << info.last_written << ' ' << std::setfill(' ') << std::dec << name << '\n';
-			break;
+	if (blocks.empty() || blocks.back().size() - block_used < len + 1U) {
+		blocks.push_back(std::vector<char>(len + 1U > BLOCK_SIZE ? len + 1U : static_cast<std::size_t>(BLOCK_SIZE)));
+		block_used = 0;
 	}
+	char * s(&blocks.back()[block_used]);
+	std::memcpy(s, p, len);
+	s[len] = '\0';
+	block_used += len + 1U;
+	return s;
 }
 
-static inline
 void
-puthash (
-	std::ostream & s,
-	const Information & info
+PathTable::grow()
+{
+	std::vector<PathID> bigger(slots.size() * 2U, NO_PATH);
+	const std::size_t mask(bigger.size() - 1U);
+	for (PathID id(0); id < names.size(); ++id) {
+		std::size_t i(hashes[id] & mask);
+		while (NO_PATH != bigger[i]) i = (i + 1U) & mask;
+		bigger[i] = id;
+	}
+	slots.swap(bigger);
+}
+
+PathID
+PathTable::intern(
+	const char * p,
+	std::size_t len
 ) {
-	s << std::hex << std::setfill('0');
-	for ( std::size_t j(0);j < sizeof info.hash/sizeof *info.hash; ++j)
-		s << std::setw(2) << static_cast<unsigned int>(info.hash[j]);
-	s << std::setfill(' ') << std::dec;
+	canonicalize(p, len);
+	const uint32_t h(hash(scratch.data(), scratch.length()));
+	if (2U * (names.size() + 1U) > slots.size())
+		grow();
+	const std::size_t mask(slots.size() - 1U);
+	std::size_t i(h & mask);
+	for (; NO_PATH != slots[i]; i = (i + 1U) & mask) {
+		const PathID id(slots[i]);
+		if (hashes[id] == h && lengths[id] == scratch.length() && 0 == std::memcmp(names[id], scratch.data(), scratch.length()))
+			return id;
+	}
+	const PathID id(static_cast<PathID>(names.size()));
+	names.push_back(store(scratch.data(), scratch.length()));
+	lengths.push_back(static_cast<uint32_t>(scratch.length()));
+	hashes.push_back(h);
+	slots[i] = id;
+	return id;
 }
 
-/* The GNU make jobserver ***************************************************
+static PathTable paths;
+
+/* Content hash algorithms **************************************************
 // **************************************************************************
 */
 
-static unsigned implicit_jobs = 1;
+// CubeHash is the default.
+// Each database records which algorithm its file hashes were made with, and hashes are only ever compared with hashes made by the same algorithm.
+enum HashAlgorithm { CUBEHASH, XXH3_128_HASH, UNKNOWN_HASH_ALGORITHM };
+
+static const char * const hash_algorithm_names[UNKNOWN_HASH_ALGORITHM] = { "cubehash", "xxh3-128" };
+
+static HashAlgorithm hash_algorithm(CUBEHASH);
 
 static inline
-bool
-try_procure_job_slot(
-	const char * prog
+HashAlgorithm
+parse_hash_algorithm (
+	const char * name,
+	std::size_t length
 ) {
-	if (implicit_jobs) {
-		--implicit_jobs;
-		if (debug) {
-			msg(prog, "INFO") << "Re-using implicit job slot that is this process itself.\n";
-		}
-		return true;
+	for (std::size_t j(0); j < sizeof hash_algorithm_names/sizeof *hash_algorithm_names; ++j)
+		if (std::strlen(hash_algorithm_names[j]) == length && 0 == std::memcmp(name, hash_algorithm_names[j], length))
+			return static_cast<HashAlgorithm>(j);
+	return UNKNOWN_HASH_ALGORITHM;
+}
+
+/// A hash of either kind, with a 256-bit result; shorter hashes are padded with zeroes.
+class ContentHash {
+public:
+	unsigned char hashval[32];
+	ContentHash(HashAlgorithm a) : algorithm(a) {}
+	void Update(const unsigned char * data, std::size_t len)
+	{
+		if (XXH3_128_HASH == algorithm)
+			xxh3.Update(data, len);
+		else
+			cubehash.Update(data, len);
 	}
-	if (-1 != jobserver_fds[0]) {
-		pollfd p;
-		p.fd = jobserver_fds[0];
-		p.events = POLLIN;
-		const int r0(poll(&p, sizeof p/sizeof(pollfd), 0));
-		if ((0 <= r0) && (p.revents & POLLIN)) {
-			char c;
-			const int r(read(jobserver_fds[0], &c, sizeof c));
-			if (debug) {
-				if (0 < r)
-					msg(prog, "INFO") << "Procured a job slot from the jobserver.\n";
-				else
-					msg(prog, "INFO") << "Failed to procure a job slot from the jobserver.\n";
-			}
-			return 0 < r;
+	void Final()
+	{
+		std::memset(hashval, 0, sizeof hashval);
+		if (XXH3_128_HASH == algorithm) {
+			xxh3.Final();
+			std::memcpy(hashval, xxh3.hashval, sizeof xxh3.hashval);
+		} else {
+			cubehash.Final();
+			std::memcpy(hashval, cubehash.hashval, sizeof cubehash.hashval);
 		}
 	}
-	return false;
+protected:
+	HashAlgorithm algorithm;
+	CubeHashSHA3AHS256 cubehash;
+	XXH3_128 xxh3;
+};
+
+/* struct Information and the cache of directory entry information **********
+// **************************************************************************
+*/
+
+struct Information {
+	enum { NOTHING, SPECIAL, DIRECTORY, FILE, NO_DO_FILE } type;	///< NO_DO_FILE occurs only in the database, and never in the filesystem
+	HashAlgorithm hash_algorithm;
+	std::time_t last_written;
+	long last_written_nsec;
+	uint64_t size;
+	uint64_t inode;
+	bool has_fingerprint;	///< whether last_written_nsec, size, and inode are known; database records from older versions lack them
+	unsigned char hash[32];		// 256 bits
+};
+
+static inline
+bool
+same_timestamp (
+	const Information & fs,
+	const Information & db
+) {
+	return fs.last_written == db.last_written && (!db.has_fingerprint || fs.last_written_nsec == db.last_written_nsec);
 }
 
+/// Whether the filesystem object is definitely the same version that the database recorded.
+/// Anything less than an exact match of the whole fingerprint is ambiguous, and the hash must be recalculated.
 static inline
 bool
-procure_job_slot(
-	const char * prog
+same_fingerprint (
+	const Information & fs,
+	const Information & db
 ) {
-	if (implicit_jobs) {
-		--implicit_jobs;
-		if (debug) {
-			msg(prog, "INFO") << "Re-using implicit job slot that is this process itself.\n";
-		}
-		return true;
-	}
-	if (-1 != jobserver_fds[0]) {
-		char c;
-		const int r(read(jobserver_fds[0], &c, sizeof c));
-		if (debug) {
-			if (0 < r)
-				msg(prog, "INFO") << "Procured a job slot from the jobserver.\n";
-			else
-				msg(prog, "INFO") << "Failed to procure a job slot from the jobserver.\n";
-		}
-		return 0 < r;
-	}
-	return false;
+	return db.has_fingerprint
+	&&     fs.has_fingerprint
+	&&     fs.last_written == db.last_written
+	&&     fs.last_written_nsec == db.last_written_nsec
+	&&     fs.size == db.size
+	&&     fs.inode == db.inode;
 }
 
 static inline
 void
-vacate_job_slot(
-	const char * prog
+clear_hash (
+	Information & i
 ) {
-	if (-1 != jobserver_fds[1]) {
-		const char c('\0');
-		write(jobserver_fds[1], &c, sizeof c);
-		if (debug) {
-			msg(prog, "INFO") << "Vacated a job slot to the jobserver.\n";
-		}
-	} else
-		++implicit_jobs;
+	for ( std::size_t j(0);j < sizeof i.hash/sizeof *i.hash; ++j)
+		i.hash[j] = 0;
 }
 
-/* Redo internals ***********************************************************
-// **************************************************************************
-*/
-
+/// Fill in everything but the hash; and return true if the hash still needs to be calculated from the file contents.
 static inline
 bool
-record_prerequisites (
-	const char * prog,
-	const std::vector<const char *> & filev
+stat_file_info (
+	const std::string & name,
+	const Information * old_info,
+	HashAlgorithm algorithm,
+	Information & i,
+	struct stat & stbuf
 ) {
-	if (-1 == redoparent_fd) {
-		msg(prog, "ERROR") << "Not invoked within a .do script.\n";
+	i.hash_algorithm = algorithm;
+	if (0 > posix_lstat(name.c_str(), &stbuf)) {
+		i.type = i.NOTHING;
+		i.last_written = -1;
+		i.last_written_nsec = 0;
+		i.size = i.inode = 0U;
+		i.has_fingerprint = true;
+		clear_hash(i);
 		return false;
 	}
-	if (debug) {
-		msg(prog, "INFO") << "RECORD-PREREQUISITES: >";
-		for ( std::vector<const char *>::const_iterator i = filev.begin(); i != filev.end(); ++i ) {
-			const char * arg(*i);
-			std::clog << ' ' << arg;
-		}
-		std::clog << '<' << std::endl;
-	}
-
-	std::ostringstream tmp_db;
-	for ( std::vector<const char *>::const_iterator i = filev.begin(); i != filev.end(); ++i ) {
-		const char * arg(*i);
-		const Information & info(get_file_info(arg, 0));
-		write_db_line(tmp_db, info, arg);
-		if (tmp_db.fail()) {
-			int error = errno;
-			msg(prog, "ERROR") << std::strerror(error) << "\n";
+	i.last_written = stbuf.st_mtime;
+	i.last_written_nsec = mtime_nsec(stbuf);
+	i.size = static_cast<uint64_t>(stbuf.st_size);
+	i.inode = static_cast<uint64_t>(stbuf.st_ino);
+	i.has_fingerprint = true;
+	if (S_ISREG(stbuf.st_mode)) {
+		i.type = i.FILE;
+		// A file modified within the last couple of seconds could have been modified again since the database was written, without its timestamp changing.
+		if (old_info && algorithm == old_info->hash_algorithm && same_fingerprint(i, *old_info) && stbuf.st_mtime + 2 <= std::time(0)) {
+			memmove(i.hash, old_info->hash, sizeof i.hash);
 			return false;
 		}
-	}
-	const std::string & s(tmp_db.str());
-	if (0 > write(redoparent_fd, s.c_str(), s.length())) {
-		int error = errno;
-		msg(prog, "ERROR") << std::strerror(error) << "\n";
+		return true;
+	} else {
+		if (S_ISDIR(stbuf.st_mode))
+			i.type = i.DIRECTORY;
+		else
+			i.type = i.SPECIAL;
+		clear_hash(i);
 		return false;
 	}
+}
 
-	return true;
+/* Statistics ***************************************************************
+// **************************************************************************
+*/
+
+static inline
+double
+monotonic_seconds()
+{
+#if defined(CLOCK_MONOTONIC)
+	struct timespec ts;
+	if (0 <= clock_gettime(CLOCK_MONOTONIC, &ts))
+		return static_cast<double>(ts.tv_sec) + static_cast<double>(ts.tv_nsec) / 1E9;
+#endif
+	return static_cast<double>(std::clock()) / CLOCKS_PER_SEC;
 }
 
-static inline bool redo (bool, const char * prog, unsigned meta_depth, const std::vector<const char *> & filev);
+static unsigned long long hashed_bytes(0);
+static double hashing_seconds(0.0);
 
-static
-bool
-redo_ifcreate (
-	const char * prog,
-	const std::vector<const char *> & filev
+#if !defined(__OS2__) && !defined(__WIN32__) && !defined(__NT__)
+// File information is gathered by several threads at once, so shared state is guarded by mutexes.
+class MutexLock {
+public:
+	explicit MutexLock(pthread_mutex_t & m) : mutex(m) { pthread_mutex_lock(&mutex); }
+	~MutexLock() { pthread_mutex_unlock(&mutex); }
+protected:
+	pthread_mutex_t & mutex;
+};
+
+static pthread_mutex_t statistics_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static inline
+void
+count_hashed_bytes (
+	unsigned long long n
 ) {
-	bool status(true);
-	for ( std::vector<const char *>::const_iterator i = filev.begin(); i != filev.end(); ++i ) {
-		const char * arg(*i);
-		if (0 <= access(arg, F_OK)) {
-			msg(prog, "ERROR") << arg << ": File/directory exists.\n";
-			status = false;
-			continue;
-		}
-	}
-	if (!status) return status;
+#if !defined(__OS2__) && !defined(__WIN32__) && !defined(__NT__)
+	MutexLock lock(statistics_mutex);
+#endif
+	hashed_bytes += n;
+}
 
-	return record_prerequisites (prog, filev);
+// Only the outermost of any nested timers accumulates, so that time is not counted twice.
+// When hashing is done by several threads, the timer around the whole of it is the outermost.
+class HashingTimer {
+public:
+	HashingTimer();
+	~HashingTimer();
+protected:
+	static unsigned depth;
+	double start;
+};
+unsigned HashingTimer::depth(0U);
+
+HashingTimer::HashingTimer() :
+	start(monotonic_seconds())
+{
+#if !defined(__OS2__) && !defined(__WIN32__) && !defined(__NT__)
+	MutexLock lock(statistics_mutex);
+#endif
+	++depth;
+}
+
+HashingTimer::~HashingTimer()
+{
+#if !defined(__OS2__) && !defined(__WIN32__) && !defined(__NT__)
+	MutexLock lock(statistics_mutex);
+#endif
+	if (0U == --depth) hashing_seconds += monotonic_seconds() - start;
 }
 
 static inline
-bool
-redo_ifcreate_1 (
-	const char * prog,
-	const char * file
+void
+report_statistics (
+	const char * prog
 ) {
-	std::vector<const char *> filev;
-	filev.push_back(file);
-	return redo_ifcreate(prog, filev);
+	if (!debug || !hashed_bytes) return;
+	msg(prog, "INFO") << "Hashed " << hashed_bytes << " bytes in " << hashing_seconds << " seconds";
+	if (hashing_seconds > 0.0)
+		std::clog << " (" << static_cast<unsigned long long>(static_cast<double>(hashed_bytes) / hashing_seconds) << " bytes/s)";
+	std::clog << ".\n";
 }
 
+/* Append-only record files ************************************************
+// **************************************************************************
+*/
+
+// Records and databases in .redo are padded to a multiple of 8 bytes, so that their fixed-size fields can be read in place.
+enum { DATABASE_ALIGNMENT = 8U };
+
 static inline
-bool
-redo_ifchange (
-	const char * prog,
-	unsigned meta_depth,
-	const std::vector<const char *> & filev
+std::size_t
+database_padded (
+	std::size_t n
 ) {
-	return redo(false, prog, meta_depth, filev) && record_prerequisites(prog, filev);
+	return (n + DATABASE_ALIGNMENT - 1U) & ~static_cast<std::size_t>(DATABASE_ALIGNMENT - 1U);
 }
 
-static inline
+// The caches in .redo are each a file of records that are only ever appended, each with a single write() to a file opened O_APPEND, so parallel jobs can all add to it at once.
+// Each record carries a magic number and a checksum of the whole padded record, taken with the checksum field zeroed; a torn or corrupt record is skipped, and the reader resynchronizes on the next valid one.
+// Later records supersede earlier ones.
+// When a file has accumulated enough superseded records it is compacted, by writing a new file and renaming it over the old.
+// Every process checks, before appending, whether the file that it has open is still the one in place, and reopens it if not.
+// Records appended to the old file by other processes whilst it was being compacted are lost, which merely means that they have to be worked out again.
+
+#if !defined(__OS2__) && !defined(__WIN32__) && !defined(__NT__)
+class RecordFile {
+public:
+	explicit RecordFile(const char * n) : name(n), fd(-1) {}
+	~RecordFile() { if (-1 != fd) close(fd); }
+	bool open();
+	bool is_open() const { return -1 != fd; }
+	void read(std::vector<unsigned char> &);
+	void append(const void *, std::size_t);
+	void rewrite(const std::string &);
+	static uint32_t checksum(const unsigned char *, std::size_t length, std::size_t check_offset);
+	static bool intact(const unsigned char *, std::size_t length, std::size_t check_offset);
+	static void seal(std::string &, std::size_t start, std::size_t check_offset);
+	static bool replace(const char * name, const std::string & contents);
+protected:
+	const char * name;
+	int fd;
+	bool replaced() const;
+};
+
 bool
-redo_ifchange_1 (
-	const char * prog,
-	unsigned meta_depth,
-	const char * file
+RecordFile::open()
+{
+	fd = ::open(name, O_RDWR|O_APPEND|O_CREAT|O_NOCTTY, 0666);
+	return -1 != fd;
+}
+
+/// Read the whole file.
+void
+RecordFile::read(
+	std::vector<unsigned char> & buf
 ) {
-	std::vector<const char *> filev;
-	filev.push_back(file);
-	return redo_ifchange(prog, meta_depth, filev);
+	std::size_t length(0);
+	for (;;) {
+		if (buf.size() < length + 65536U)
+			buf.resize(length + 65536U);
+		const ssize_t n(pread(fd, &buf[length], buf.size() - length, static_cast<off_t>(length)));
+		if (0 >= n) break;
+		length += static_cast<std::size_t>(n);
+	}
+	buf.resize(length);
 }
 
-static inline
+/// Whether another process has renamed a compacted file over the one that is open.
 bool
-find_do_file (
-	const char * prog,
-	unsigned meta_depth,
-	const char * const arg,
-	const char * const b,
-	std::string & dofile_name,
-	std::string & base,
-	std::string & ext
+RecordFile::replaced() const
+{
+	struct stat a, b;
+	return 0 <= fstat(fd, &a) && (0 > stat(name, &b) || a.st_dev != b.st_dev || a.st_ino != b.st_ino);
+}
+
+void
+RecordFile::append(
+	const void * p,
+	std::size_t length
 ) {
-	const char * const be(extension(b));
-	std::string dir(arg, static_cast<std::size_t>(b - arg));
-	for (;;) {
-		base = b;
-		ext = std::string();
-		dofile_name = dir + base + ".do";
-		if (0 <= access(dofile_name.c_str(), F_OK)) {
-			redo_ifchange_1(prog, meta_depth + 1, dofile_name.c_str());
-			return true;
-		} else
-			redo_ifcreate_1(prog, dofile_name.c_str());
-
-		for (const char * e(be); ; e = extension(e + 1)) {
-			base = std::string(b, static_cast<std::size_t>(e - b));
-			ext = e;
-			dofile_name = dir + "default" + ext + ".do";
-			if (0 <= access(dofile_name.c_str(), F_OK)) {
-				redo_ifchange_1(prog, meta_depth + 1, dofile_name.c_str());
-				return true;
-			} else
-				redo_ifcreate_1(prog, dofile_name.c_str());
+	if (-1 == fd) return;
+	if (replaced()) {
+		close(fd);
+		if (!open()) return;
+	}
+	write(fd, p, length);
+}
 
-			if (!*e) break;
-		}
+/// Replace the file with just the given records, unless another process is already doing so.
+void
+RecordFile::rewrite(
+	const std::string & contents
+) {
+	struct flock lock;
+	lock.l_whence = SEEK_SET;
+	lock.l_start = 0;
+	lock.l_len = 0;
+	lock.l_type = F_WRLCK;
+	// Someone else compacting, or having already compacted since the file was read, is as good as us compacting.
+	if (0 > fcntl(fd, F_SETLK, &lock) || replaced()) return;
+	if (!replace(name, contents)) return;
+	close(fd);
+	open();
+}
 
-		std::string::size_type len(dir.length());
-		if (len < 2) return false;
-		std::string::size_type slash(dir.find_last_of('/', len - 2));
-#if defined(__OS2__) || defined(__WIN32__) || defined(__NT__)
-		if (std::string::npos == slash)
-			slash = dir.find_last_of('\\', len - 2);
-#endif
-		if (std::string::npos == slash)
-			dir = std::string();
-		else
-			dir = dir.substr(0, slash + 1);
+/// Atomically replace a file, by writing a new one alongside it and renaming that over it.
+/// The new file is named for this process, so that two processes replacing the file at once cannot write into the same new file.
+bool
+RecordFile::replace(
+	const char * name,
+	const std::string & contents
+) {
+	std::ostringstream new_name;
+	new_name << name << ".new." << getpid();
+	const int new_fd(::open(new_name.str().c_str(), O_WRONLY|O_TRUNC|O_CREAT|O_NOCTTY, 0666));
+	if (0 > new_fd) return false;
+	const bool ok(contents.empty() || static_cast<ssize_t>(contents.length()) == write(new_fd, contents.data(), contents.length()));
+	close(new_fd);
+	if (!ok || 0 > posix_rename(new_name.str().c_str(), name)) {
+		std::remove(new_name.str().c_str());
+		return false;
 	}
+	return true;
 }
 
-/* Jobs *********************************************************************
+uint32_t
+RecordFile::checksum(
+	const unsigned char * p,
+	std::size_t length,
+	std::size_t check_offset
+) {
+	static const unsigned char zero[4] = { 0, 0, 0, 0 };
+	uint32_t h(fnv1a(p, check_offset));
+	h = fnv1a(zero, sizeof zero, h);
+	return fnv1a(p + check_offset + sizeof zero, length - check_offset - sizeof zero, h);
+}
+
+bool
+RecordFile::intact(
+	const unsigned char * p,
+	std::size_t length,
+	std::size_t check_offset
+) {
+	uint32_t check;
+	std::memcpy(&check, p + check_offset, sizeof check);
+	return checksum(p, length, check_offset) == check;
+}
+
+/// Pad the record that starts at the given offset, and fill in its checksum.
+void
+RecordFile::seal(
+	std::string & s,
+	std::size_t start,
+	std::size_t check_offset
+) {
+	const std::size_t length(s.length() - start);
+	s.append(database_padded(length) - length, '\0');
+	const uint32_t check(checksum(reinterpret_cast<const unsigned char *>(s.data() + start), s.length() - start, check_offset));
+	s.replace(start + check_offset, sizeof check, reinterpret_cast<const char *>(&check), sizeof check);
+}
+#endif
+
+/* The persistent hash cache ************************************************
 // **************************************************************************
 */
 
-class RedoParentFDStack {
+// Every redo process starts with an empty in-memory cache, so without this a source file would be re-hashed by every .do script that names it.
+// .redo/hashes is a sequence of fixed-size records keyed by device number, inode number, and hash algorithm, which record a hash and the exact version of the file that it is the hash of.
+// A version is the size and the modification and status change timestamps to the nanosecond; any write to the file, or any rename over it, alters at least one.
+
+#if !defined(__OS2__) && !defined(__WIN32__) && !defined(__NT__)
+class HashCache {
 public:
-	RedoParentFDStack ( int new_fd ) : old_fd(redoparent_fd) { redoparent_fd = new_fd; }
-	~RedoParentFDStack() { redoparent_fd = old_fd; }
+	HashCache() : file(".redo/hashes"), loaded(false) {}
+	bool lookup(const struct stat &, HashAlgorithm, unsigned char hash[32]);
+	void store(const struct stat &, HashAlgorithm, const unsigned char hash[32]);
 protected:
-	int old_fd;
-};
+	// Records from before hash algorithms were selectable had a different magic number, and are skipped as invalid.
+	enum { MAGIC = 0x32656448U, MIN_COMPACTION_RECORDS = 4096U };
+	struct Record {
+		uint32_t magic;
+		uint32_t mtime_nsec;
+		uint64_t dev, ino, size;
+		int64_t mtime_sec;
+		int64_t ctime_sec;
+		uint32_t ctime_nsec;
+		uint32_t algorithm;
+		uint32_t check;
+		uint32_t reserved;
+		unsigned char hash[32];
+	};
+	typedef std::pair<std::pair<uint64_t, uint64_t>, uint32_t> Key;
+	typedef std::map<Key, Record> RecordMap;
+	RecordFile file;
+	bool loaded;
+	RecordMap records;
 
-struct Job {
-	int lock_fd, pid;
-	const char * arg;
-	std::string target;
-	std::string tmp_target;
-	std::string script;
-	std::string database_name;
-	std::string tmp_database_name;
-	std::string lock_database_name;
+	static uint32_t checksum(const Record & r) { return RecordFile::checksum(reinterpret_cast<const unsigned char *>(&r), sizeof r, offsetof(Record, check)); }
+	static Key key(const Record & r) { return Key(std::pair<uint64_t, uint64_t>(r.dev, r.ino), r.algorithm); }
+	static void make_record(Record &, const struct stat &, HashAlgorithm, const unsigned char hash[32]);
+	static bool matches(const Record &, const struct stat &);
+	void load();
+	void compact();
 };
 
-static inline
-bool
-run (
-#if defined(__OS2__) || defined(__WIN32__) || defined(__NT__)
-	const char * comspec,
-#endif
-	const char * prog,
-	unsigned meta_depth,
-	Job & job
+void
+HashCache::make_record(
+	Record & r,
+	const struct stat & s,
+	HashAlgorithm algorithm,
+	const unsigned char hash[32]
 ) {
-	job.pid = -1;
+	std::memset(&r, 0, sizeof r);
+	r.magic = MAGIC;
+	r.algorithm = static_cast<uint32_t>(algorithm);
+	r.dev = static_cast<uint64_t>(s.st_dev);
+	r.ino = static_cast<uint64_t>(s.st_ino);
+	r.size = static_cast<uint64_t>(s.st_size);
+	r.mtime_sec = static_cast<int64_t>(s.st_mtime);
+	r.mtime_nsec = static_cast<uint32_t>(mtime_nsec(s));
+	r.ctime_sec = static_cast<int64_t>(s.st_ctime);
+	r.ctime_nsec = static_cast<uint32_t>(ctime_nsec(s));
+	std::memcpy(r.hash, hash, sizeof r.hash);
+	r.check = checksum(r);
+}
 
-	const char * b(basename_of(job.arg));
-	if (b != job.arg)
-		makepath(".redo/" + std::string(job.arg, static_cast<std::size_t>(b - 1 - job.arg)));
+bool
+HashCache::matches(
+	const Record & r,
+	const struct stat & s
+) {
+	return r.size == static_cast<uint64_t>(s.st_size)
+	&&     r.mtime_sec == static_cast<int64_t>(s.st_mtime)
+	&&     r.mtime_nsec == static_cast<uint32_t>(mtime_nsec(s))
+	&&     r.ctime_sec == static_cast<int64_t>(s.st_ctime)
+	&&     r.ctime_nsec == static_cast<uint32_t>(ctime_nsec(s));
+}
 
-#if defined(__OS2__) || defined(__WIN32__) || defined(__NT__)
-	int lock_fd(open(job.lock_database_name.c_str(), O_WRONLY|O_TRUNC|O_CREAT, 0777));
-#else		
-	int lock_fd(open(job.lock_database_name.c_str(), O_WRONLY|O_TRUNC|O_CREAT|O_NOCTTY, 0777));
-#endif		
-	if (0 > lock_fd) {
-		const int error(errno);
-		msg(prog, "ERROR") << job.lock_database_name << ": " << std::strerror(error) << "\n";
-		return false;
+void
+HashCache::load()
+{
+	loaded = true;
+	// The cache is only used within an existing database; it does not create one.
+	if (!file.open()) return;
+	std::vector<unsigned char> buf;
+	file.read(buf);
+	const std::size_t length(buf.size());
+	std::size_t total(0);
+	for (std::size_t off(0); off + sizeof(Record) <= length; ) {
+		Record r;
+		std::memcpy(&r, &buf[off], sizeof r);
+		if (MAGIC != r.magic || !RecordFile::intact(&buf[off], sizeof r, offsetof(Record, check))) {
+			++off;
+			continue;
+		}
+		records[key(r)] = r;
+		off += sizeof r;
+		++total;
 	}
-#if defined(__OS2__) || defined(__WIN32__) || defined(__NT__)
+	const std::size_t invalid(length - total * sizeof(Record));
+	if ((total >= MIN_COMPACTION_RECORDS && total > 2U * records.size()) || invalid >= MIN_COMPACTION_RECORDS * sizeof(Record))
+		compact();
+}
+
+void
+HashCache::compact()
+{
+	std::string all;
+	for (RecordMap::const_iterator i(records.begin()); i != records.end(); ++i)
+		all.append(reinterpret_cast<const char *>(&i->second), sizeof i->second);
+	file.rewrite(all);
+}
+
+bool
+HashCache::lookup(
+	const struct stat & s,
+	HashAlgorithm algorithm,
+	unsigned char hash[32]
+) {
+	if (!loaded) load();
+	RecordMap::const_iterator i(records.find(Key(std::pair<uint64_t, uint64_t>(s.st_dev, s.st_ino), static_cast<uint32_t>(algorithm))));
+	if (records.end() == i || !matches(i->second, s)) return false;
+	std::memcpy(hash, i->second.hash, sizeof i->second.hash);
+	return true;
+}
+
+void
+HashCache::store(
+	const struct stat & s,
+	HashAlgorithm algorithm,
+	const unsigned char hash[32]
+) {
+	if (!loaded) load();
+	if (!file.is_open()) return;
+	// A file modified within the last couple of seconds could be modified again without its timestamps changing, on filesystems with coarse timestamps.
+	const std::time_t now(std::time(0));
+	if (s.st_mtime + 2 > now || s.st_ctime + 2 > now) return;
+	Record r;
+	make_record(r, s, algorithm, hash);
+	RecordMap::iterator i(records.find(key(r)));
+	if (records.end() != i && 0 == std::memcmp(&i->second, &r, sizeof r)) return;
+	records[key(r)] = r;
+	file.append(&r, sizeof r);
+}
+
+static HashCache hash_cache;
+static pthread_mutex_t hash_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static inline
+bool
+lookup_cached_hash (
+	const struct stat & s,
+	HashAlgorithm algorithm,
+	unsigned char hash[32]
+) {
+#if !defined(__OS2__) && !defined(__WIN32__) && !defined(__NT__)
+	MutexLock lock(hash_cache_mutex);
+	return hash_cache.lookup(s, algorithm, hash);
 #else
-	if (debug) {
-		msg(prog, "INFO") << job.lock_database_name << ": Locking ...\n";
-	}
-	struct flock flock;
-	flock.l_whence = SEEK_SET;
-	flock.l_start = 0;
-	flock.l_len = 0;
-	flock.l_type = F_WRLCK;
-	int f(fcntl(lock_fd, F_SETLKW, &flock));
-	if (0 > f) {
-		const int error(errno);
-		msg(prog, "ERROR") << job.lock_database_name << ": " << std::strerror(error) << "\n";
-		close(lock_fd);
-		return false;
-	}
+	return false;
 #endif
-#if defined(__OS2__) || defined(__WIN32__) || defined(__NT__)		
-	int db_fd(open(job.tmp_database_name.c_str(), O_WRONLY|O_TRUNC|O_CREAT, 0777));
+}
+
+static inline
+void
+store_cached_hash (
+	const struct stat & s,
+	HashAlgorithm algorithm,
+	const unsigned char hash[32]
+) {
+#if !defined(__OS2__) && !defined(__WIN32__) && !defined(__NT__)
+	MutexLock lock(hash_cache_mutex);
+	hash_cache.store(s, algorithm, hash);
+#endif
+}
+
+/* Reading file contents for hashing ****************************************
+// **************************************************************************
+*/
+
+#if !defined(__OS2__) && !defined(__WIN32__) && !defined(__NT__)
+// Large files are mapped rather than read, which saves copying them through a buffer.
+// Small files are not worth the cost of setting up and tearing down a mapping.
+enum { MIN_MAPPED_HASH_SIZE = 1024 * 1024, HASH_READ_BUFFER_SIZE = 1024 * 1024 };
+
+// A file that is truncated by another process whilst it is mapped raises SIGBUS on access to the vanished pages.
+// That is caught, and the file is then re-hashed by reading it instead.
+// SIGBUS is delivered to the faulting thread, so each thread has its own recovery point; and the handler stays installed, since threads hashing at the same time cannot take turns installing and restoring it.
+static __thread sigjmp_buf * mapped_hash_fault(0);
+static pthread_once_t mapped_hash_sigbus_once = PTHREAD_ONCE_INIT;
+
+static
+void
+mapped_hash_sigbus (
+	int
+) {
+	if (mapped_hash_fault)
+		siglongjmp(*mapped_hash_fault, 1);
+	signal(SIGBUS, SIG_DFL);
+	raise(SIGBUS);
+}
+
+static
+void
+install_mapped_hash_sigbus()
+{
+	struct sigaction sa;
+	sa.sa_handler = mapped_hash_sigbus;
+	sa.sa_flags = 0;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGBUS, &sa, 0);
+}
+
+static inline
+bool
+hash_mapped (
+	int fd,
+	std::size_t size,
+	ContentHash & h
+) {
+	void * p(mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0));
+	if (MAP_FAILED == p) return false;
+#if defined(MADV_SEQUENTIAL)
+	madvise(p, size, MADV_SEQUENTIAL);
+#endif
+	pthread_once(&mapped_hash_sigbus_once, install_mapped_hash_sigbus);
+	sigjmp_buf env;
+	bool ok(false);
+	if (0 == sigsetjmp(env, 1)) {
+		mapped_hash_fault = &env;
+		h.Update(static_cast<const unsigned char *>(p), size);
+		ok = true;
+	}
+	mapped_hash_fault = 0;
+	munmap(p, size);
+	if (ok) count_hashed_bytes(size);
+	return ok;
+}
+
+static inline
+void
+hash_read (
+	int fd,
+	ContentHash & h
+) {
+#if defined(POSIX_FADV_SEQUENTIAL)
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+	std::vector<unsigned char> buf(HASH_READ_BUFFER_SIZE);
+	for (;;) {
+		const ssize_t n(read(fd, &buf.front(), buf.size()));
+		if (0 >= n) break;
+		h.Update(&buf.front(), static_cast<std::size_t>(n));
+		count_hashed_bytes(static_cast<std::size_t>(n));
+	}
+}
+#endif
+
+/// Hash the file's contents, and cache the hash if the file was the expected version throughout, returning whether it was.
+static inline
+bool
+hash_file (
+	const std::string & name,
+	Information & i,
+	const struct stat & expected
+) {
+	HashingTimer timer;
+	bool unchanged(false);
+	ContentHash h(i.hash_algorithm);
+#if defined(__OS2__) || defined(__WIN32__) || defined(__NT__)
+	std::ifstream f(name.c_str(), std::ios::binary);
+	if (!f.fail()) {
+		char buf[4096];
+		for (;;) {
+			f.read(buf, sizeof buf);
+			h.Update(reinterpret_cast<unsigned char *>(buf), static_cast<std::size_t>(f.gcount()));
+			hashed_bytes += static_cast<std::size_t>(f.gcount());
+			if (f.eof()) break;
+		}
+	}
+#else
+	const int fd(open(name.c_str(), O_RDONLY|O_NOCTTY));
+	if (0 <= fd) {
+		struct stat stbuf;
+		if (0 <= fstat(fd, &stbuf)
+		&&  S_ISREG(stbuf.st_mode)
+		&&  MIN_MAPPED_HASH_SIZE <= stbuf.st_size
+		&&  static_cast<unsigned long long>(stbuf.st_size) == static_cast<std::size_t>(stbuf.st_size)
+		&&  hash_mapped(fd, static_cast<std::size_t>(stbuf.st_size), h)
+		)
+			;
+		else {
+			h = ContentHash(i.hash_algorithm);
+			lseek(fd, 0, SEEK_SET);
+			hash_read(fd, h);
+		}
+		struct stat after;
+		unchanged = 0 <= fstat(fd, &after) && same_file_version(expected, after);
+		close(fd);
+	}
+#endif
+	h.Final();
+	for ( std::size_t j(0);j < sizeof i.hash/sizeof *i.hash; ++j)
+		i.hash[j] = h.hashval[j];
+	if (unchanged)
+		store_cached_hash(expected, i.hash_algorithm, i.hash);
+	return unchanged;
+}
+
+static inline
+Information
+read_file_info (
+	const std::string & name,
+	const Information * old_info,
+	HashAlgorithm algorithm
+) {
+	Information i;
+	struct stat stbuf;
+	if (stat_file_info(name, old_info, algorithm, i, stbuf) && !lookup_cached_hash(stbuf, algorithm, i.hash))
+		hash_file(name, i, stbuf);
+	return i;
+}
+
+// Since path IDs are small and dense, the cache is indexed by them directly rather than hashed.
+// A deque is used so that growing it does not move the information that callers hold references to.
+class FileInfoCache {
+public:
+	Information * find(PathID id) { return id < present.size() && present[id] ? &infos[id] : 0; }
+	Information & insert(PathID id, const Information & i);
+	void erase(PathID id) { if (id < present.size()) present[id] = false; }
+	void clear() { present.assign(present.size(), false); }
+protected:
+	std::deque<Information> infos;
+	std::vector<bool> present;
+};
+
+Information &
+FileInfoCache::insert(
+	PathID id,
+	const Information & i
+) {
+	if (id >= infos.size()) {
+		infos.resize(id + 1U);
+		present.resize(id + 1U, false);
+	}
+	present[id] = true;
+	return infos[id] = i;
+}
+
+static FileInfoCache file_info_cache;
+
+/// The hash is made with the same algorithm as the database information that it is to be compared against, or failing that with the current algorithm.
+static inline
+HashAlgorithm
+wanted_hash_algorithm (
+	const Information * old_info
+) {
+	return old_info ? old_info->hash_algorithm : hash_algorithm;
+}
+
+/// A request for the information about a file, to be compared against old_info if there is any.
+/// A file that has already been stat()ed carries the result, so that only its contents remain to be hashed.
+struct FileInfoRequest {
+	FileInfoRequest(PathID n, const Information * o) : name(n), old_info(o), stated(false) {}
+	PathID name;
+	const Information * old_info;
+	bool stated;	///< whether info and version already hold what stat_file_info() found
+	Information info;
+	struct stat version;
+};
+
+typedef std::vector<FileInfoRequest> FileInfoRequests;
+
+/* The file information server **********************************************
+// **************************************************************************
+*/
+
+// redo --file-info-server starts a server process that answers batches of file information lookups on behalf of every redo-ifchange beneath it, on a pool of threads.
+// It remembers the information that it has handed out, by canonical absolute name, for the whole of the build, so that a file that many targets depend from is hashed once rather than once per redo-ifchange.
+// Every file is still lstat()ed on every lookup, and what is remembered about it is used only whilst its version is unchanged.
+// Clients also tell the server about every target that they rename into place, whereupon what it remembers about the name is forgotten.
+// Only file information lookups are served; redo-ifcreate and the scheduling of jobs remain the business of each client.
+// A lookup of a single file is not worth a round trip, and is made by the client itself.
+// Clients hold one end of a SOCK_SEQPACKET socket pair, whose descriptor number is passed in REDOFLAGS, and send each lookup with one end of a new socket pair, down which the reply comes.
+// The descriptor is close-on-exec, except in the .do scripts that pass it on to the redo-ifchange within them.
+// Because a .do script can leave something running that still holds it, the top-level redo tells the server to exit when it is done, rather than the server waiting for every client to go away.
+// A client that cannot reach the server, for whatever reason, gathers the information itself, as it always has.
+// Names are sent as absolute pathnames, since a .do script can run redo-ifchange from anywhere.
+// The server is the same program as its clients, so information is sent as it is held in memory.
+
+#if !defined(__OS2__) && !defined(__WIN32__) && !defined(__NT__)
+enum {
+	FILE_INFO_SERVER_MAGIC = 0x53494672U,
+	MAX_SERVED_MESSAGE = 64U * 1024U,
+	MAX_SERVED_REQUESTS = 256U,
+	FILE_INFO_SERVER_THREADS = 8U
+};
+
+enum ServedRequestKind { SERVED_LOOKUP, SERVED_FORGET, SERVED_SHUTDOWN };
+
+#if defined(MSG_NOSIGNAL)
+enum { SERVED_SEND_FLAGS = MSG_NOSIGNAL };
+#else
+enum { SERVED_SEND_FLAGS = 0 };
+#endif
+
+struct ServedRequestHeader {
+	uint32_t magic;
+	uint32_t information_size;	///< guards against a server and client that hold information differently
+	uint32_t count;
+	uint32_t kind;
+};
+
+struct ServedRequest {
+	uint32_t name_length;
+	uint8_t has_old_info;
+	uint8_t algorithm;
+	uint16_t reserved;
+	Information old_info;
+};
+
+static inline
+void
+set_close_on_exec (
+	int fd,
+	bool on
+) {
+	const int flags(fcntl(fd, F_GETFD));
+	if (0 <= flags)
+		fcntl(fd, F_SETFD, on ? flags | FD_CLOEXEC : flags & ~FD_CLOEXEC);
+}
+
+/// What the server has handed out about each file, shared by all of its threads.
+// Names are canonicalized by a path table of its own, since clients send them from many different directories.
+class ServedFileInfoCache {
+public:
+	ServedFileInfoCache() { pthread_mutex_init(&mutex, 0); }
+	~ServedFileInfoCache() { pthread_mutex_destroy(&mutex); }
+	bool find(const std::string & name, HashAlgorithm algorithm, const struct stat & version, Information & info);
+	void insert(const std::string & name, const struct stat & version, const Information & info);
+	void erase(const std::string & name);
+protected:
+	struct Entry {
+		Information info;
+		struct stat version;
+	};
+	pthread_mutex_t mutex;
+	PathTable names;
+	std::deque<Entry> entries;
+	std::vector<bool> present;
+};
+
+bool
+ServedFileInfoCache::find(
+	const std::string & name,
+	HashAlgorithm algorithm,
+	const struct stat & version,
+	Information & info
+) {
+	MutexLock lock(mutex);
+	const PathID id(names.intern(name));
+	if (id >= present.size() || !present[id]) return false;
+	const Entry & e(entries[id]);
+	if (algorithm != e.info.hash_algorithm || !same_file_version(version, e.version)) return false;
+	info = e.info;
+	return true;
+}
+
+void
+ServedFileInfoCache::insert(
+	const std::string & name,
+	const struct stat & version,
+	const Information & info
+) {
+	MutexLock lock(mutex);
+	const PathID id(names.intern(name));
+	if (id >= entries.size()) {
+		entries.resize(id + 1U);
+		present.resize(id + 1U, false);
+	}
+	present[id] = true;
+	entries[id].info = info;
+	entries[id].version = version;
+}
+
+void
+ServedFileInfoCache::erase(
+	const std::string & name
+) {
+	MutexLock lock(mutex);
+	const PathID id(names.intern(name));
+	if (id < present.size()) present[id] = false;
+}
+
+struct FileInfoServer {
+	explicit FileInfoServer(int f) : fd(f) {}
+	int fd;
+	ServedFileInfoCache cache;
+};
+
+static
+int
+receive_with_fd (
+	int fd,
+	void * buf,
+	std::size_t len,
+	int & received_fd
+) {
+	char control[CMSG_SPACE(sizeof(int))];
+	struct iovec iov;
+	iov.iov_base = buf;
+	iov.iov_len = len;
+	struct msghdr m;
+	std::memset(&m, 0, sizeof m);
+	m.msg_iov = &iov;
+	m.msg_iovlen = 1;
+	m.msg_control = control;
+	m.msg_controllen = sizeof control;
+	received_fd = -1;
+	const int n(recvmsg(fd, &m, 0));
+	if (0 > n) return n;
+	for (struct cmsghdr * c(CMSG_FIRSTHDR(&m)); c; c = CMSG_NXTHDR(&m, c))
+		if (SOL_SOCKET == c->cmsg_level && SCM_RIGHTS == c->cmsg_type)
+			std::memcpy(&received_fd, CMSG_DATA(c), sizeof received_fd);
+	return n;
+}
+
+static
+int
+send_with_fd (
+	int fd,
+	const void * buf,
+	std::size_t len,
+	int sent_fd
+) {
+	char control[CMSG_SPACE(sizeof(int))];
+	std::memset(control, 0, sizeof control);
+	struct iovec iov;
+	iov.iov_base = const_cast<void *>(buf);
+	iov.iov_len = len;
+	struct msghdr m;
+	std::memset(&m, 0, sizeof m);
+	m.msg_iov = &iov;
+	m.msg_iovlen = 1;
+	m.msg_control = control;
+	m.msg_controllen = sizeof control;
+	struct cmsghdr * c(CMSG_FIRSTHDR(&m));
+	c->cmsg_level = SOL_SOCKET;
+	c->cmsg_type = SCM_RIGHTS;
+	c->cmsg_len = CMSG_LEN(sizeof(int));
+	std::memcpy(CMSG_DATA(c), &sent_fd, sizeof sent_fd);
+	return sendmsg(fd, &m, SERVED_SEND_FLAGS);
+}
+
+/// Obtain the information about a file, hashing it only if neither the server nor the hash cache already has a hash for this version of it.
+static inline
+void
+serve_file_info (
+	ServedFileInfoCache & cache,
+	const std::string & name,
+	const Information * old_info,
+	HashAlgorithm algorithm,
+	Information & i
+) {
+	struct stat stbuf;
+	if (stat_file_info(name, old_info, algorithm, i, stbuf)
+	&&  !cache.find(name, algorithm, stbuf, i)
+	&&  !lookup_cached_hash(stbuf, algorithm, i.hash)
+	&&  hash_file(name, i, stbuf)
+	)
+		cache.insert(name, stbuf, i);
+}
+
+/// Answer requests until told to stop, or until every client has gone away.
+static
+void *
+file_info_server_worker (
+	void * p
+) {
+	FileInfoServer & server(*static_cast<FileInfoServer *>(p));
+	std::vector<char> buf(MAX_SERVED_MESSAGE);
+	std::vector<Information> results;
+	for (;;) {
+		int reply_fd;
+		const int n(receive_with_fd(server.fd, &buf.front(), buf.size(), reply_fd));
+		if (0 > n && EINTR == errno) continue;
+		if (0 >= n) break;
+		ServedRequestHeader h;
+		std::size_t off(sizeof h);
+		if (static_cast<std::size_t>(n) >= off) std::memcpy(&h, &buf.front(), sizeof h);
+		if (static_cast<std::size_t>(n) < off || FILE_INFO_SERVER_MAGIC != h.magic || sizeof(Information) != h.information_size || h.count > MAX_SERVED_REQUESTS) {
+			if (-1 != reply_fd) close(reply_fd);
+			continue;
+		}
+		if (SERVED_SHUTDOWN == h.kind) _exit(0);
+		if (SERVED_LOOKUP == h.kind && -1 == reply_fd) continue;
+		results.resize(h.count);
+		bool ok(true);
+		for (uint32_t j(0); ok && j < h.count; ++j) {
+			ServedRequest r;
+			if (off + sizeof r > static_cast<std::size_t>(n)) { ok = false; break; }
+			std::memcpy(&r, &buf[off], sizeof r);
+			off += sizeof r;
+			if (r.name_length > static_cast<std::size_t>(n) - off || r.algorithm >= UNKNOWN_HASH_ALGORITHM) { ok = false; break; }
+			const std::string name(&buf[off], r.name_length);
+			off += r.name_length;
+			if (SERVED_FORGET == h.kind)
+				server.cache.erase(name);
+			else
+				serve_file_info(server.cache, name, r.has_old_info ? &r.old_info : 0, static_cast<HashAlgorithm>(r.algorithm), results[j]);
+		}
+		if (-1 != reply_fd) {
+			if (ok && SERVED_LOOKUP == h.kind && h.count)
+				send(reply_fd, &results.front(), h.count * sizeof(Information), SERVED_SEND_FLAGS);
+			close(reply_fd);
+		}
+	}
+	return 0;
+}
+
+/// Start the server, in a process of its own that is not a child of this one, so that it is not mistaken for a finished job.
+static
+bool
+start_file_info_server (
+	const char * prog
+) {
+	int fds[2];
+	if (0 > socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds)) {
+		const int error(errno);
+		msg(prog, "ERROR") << "socketpair: " << std::strerror(error) << "\n";
+		return false;
+	}
+	const pid_t pid(fork());
+	if (0 > pid) {
+		const int error(errno);
+		msg(prog, "ERROR") << "fork: " << std::strerror(error) << "\n";
+		close(fds[0]);
+		close(fds[1]);
+		return false;
+	}
+	if (0 == pid) {
+		close(fds[1]);
+		if (0 != fork()) _exit(0);
+		for (unsigned j(0); j < sizeof jobserver_fds/sizeof *jobserver_fds; ++j)
+			if (-1 != jobserver_fds[j]) close(jobserver_fds[j]);
+		// The server must not keep the terminal, or a pipe that something is reading redo's output from, open after redo has finished.
+		const int null_fd(open("/dev/null", O_RDWR|O_NOCTTY));
+		if (0 <= null_fd) {
+			dup2(null_fd, STDIN_FILENO);
+			dup2(null_fd, STDOUT_FILENO);
+			dup2(null_fd, STDERR_FILENO);
+			if (STDERR_FILENO < null_fd) close(null_fd);
+		}
+		FileInfoServer server(fds[0]);
+		std::vector<pthread_t> threads;
+		for (unsigned j(1U); j < FILE_INFO_SERVER_THREADS; ++j) {
+			pthread_t t;
+			if (0 != pthread_create(&t, 0, file_info_server_worker, &server)) break;
+			threads.push_back(t);
+		}
+		file_info_server_worker(&server);
+		for (std::vector<pthread_t>::const_iterator t(threads.begin()); t != threads.end(); ++t)
+			pthread_join(*t, 0);
+		_exit(0);
+	}
+	close(fds[0]);
+	waitpid(pid, 0, 0);
+	set_close_on_exec(fds[1], true);
+	file_info_server_fd = fds[1];
+	return true;
+}
+
+static
+void
+abandon_file_info_server()
+{
+	close(file_info_server_fd);
+	file_info_server_fd = -1;
+}
+
+/// Start a message to the server.
+static inline
+std::string
+served_message_header (
+	ServedRequestKind kind
+) {
+	ServedRequestHeader h;
+	h.magic = FILE_INFO_SERVER_MAGIC;
+	h.information_size = sizeof(Information);
+	h.count = 0;
+	h.kind = kind;
+	return std::string(reinterpret_cast<const char *>(&h), sizeof h);
+}
+
+/// Add a request about the named file to a message to the server, unless the message is already full.
+static inline
+bool
+append_served_request (
+	std::string & message,
+	const std::string & cwd,
+	PathID name,
+	const Information * old_info
+) {
+	ServedRequestHeader h;
+	std::memcpy(&h, message.data(), sizeof h);
+	if (h.count >= MAX_SERVED_REQUESTS) return false;
+	const bool absolute('/' == *paths.name(name));
+	ServedRequest r;
+	std::memset(&r, 0, sizeof r);
+	r.name_length = static_cast<uint32_t>(paths.length(name) + (absolute ? 0U : cwd.length()));
+	if (h.count && message.length() + sizeof r + r.name_length > MAX_SERVED_MESSAGE) return false;
+	r.algorithm = static_cast<uint8_t>(wanted_hash_algorithm(old_info));
+	if (old_info) {
+		r.has_old_info = 1;
+		r.old_info = *old_info;
+	}
+	message.append(reinterpret_cast<const char *>(&r), sizeof r);
+	if (!absolute) message += cwd;
+	message.append(paths.name(name), paths.length(name));
+	++h.count;
+	std::memcpy(&message[0], &h, sizeof h);
+	return true;
+}
+
+/// The directory that relative names are sent relative to, with a trailing slash; or empty if it cannot be found.
+static inline
+const std::string &
+served_cwd()
+{
+	static std::string cwd;
+	if (cwd.empty()) {
+		char buf[PATH_MAX];
+		if (getcwd(buf, sizeof buf)) {
+			cwd = buf;
+			if ('/' != cwd[cwd.length() - 1]) cwd += '/';
+		}
+	}
+	return cwd;
+}
+#endif
+
+/// Ask the server for information about several files; or return false if there is no server or it did not answer.
+static
+bool
+served_file_infos (
+	const FileInfoRequest * requests,
+	std::size_t count,
+	Information * results
+) {
+#if !defined(__OS2__) && !defined(__WIN32__) && !defined(__NT__)
+	if (-1 == file_info_server_fd) return false;
+	const std::string & cwd(served_cwd());
+	if (cwd.empty()) return false;
+	for (std::size_t j(0); j < count; ) {
+		std::string message(served_message_header(SERVED_LOOKUP));
+		std::size_t k(j);
+		while (k < count && append_served_request(message, cwd, requests[k].name, requests[k].old_info))
+			++k;
+		int reply[2];
+		if (0 > socketpair(AF_UNIX, SOCK_SEQPACKET, 0, reply)) return false;
+		const bool sent(static_cast<ssize_t>(message.length()) == send_with_fd(file_info_server_fd, message.data(), message.length(), reply[1]));
+		close(reply[1]);
+		const std::size_t wanted((k - j) * sizeof(Information));
+		const bool received(sent && static_cast<ssize_t>(wanted) == recv(reply[0], results + j, wanted, 0));
+		close(reply[0]);
+		if (!received) {
+			abandon_file_info_server();
+			return false;
+		}
+		j = k;
+	}
+	return true;
+#else
+	static_cast<void>(requests);
+	static_cast<void>(count);
+	static_cast<void>(results);
+	return false;
+#endif
+}
+
+/// Tell the server that a target has been replaced, so that it forgets what it knows about the old one.
+static inline
+void
+forget_served_file_info (
+	PathID name
+) {
+#if !defined(__OS2__) && !defined(__WIN32__) && !defined(__NT__)
+	if (-1 == file_info_server_fd) return;
+	const std::string & cwd(served_cwd());
+	if (cwd.empty()) return;
+	std::string message(served_message_header(SERVED_FORGET));
+	append_served_request(message, cwd, name, 0);
+	if (static_cast<ssize_t>(message.length()) != send(file_info_server_fd, message.data(), message.length(), SERVED_SEND_FLAGS))
+		abandon_file_info_server();
+#else
+	static_cast<void>(name);
+#endif
+}
+
+/// Tell the server to exit, now that the build that it was started for is done.
+static inline
+void
+stop_file_info_server()
+{
+#if !defined(__OS2__) && !defined(__WIN32__) && !defined(__NT__)
+	if (-1 == file_info_server_fd) return;
+	const std::string message(served_message_header(SERVED_SHUTDOWN));
+	send(file_info_server_fd, message.data(), message.length(), SERVED_SEND_FLAGS);
+	abandon_file_info_server();
+#endif
+}
+
+static
+Information &
+get_file_info (
+	PathID name,
+	const Information * old_info
+) {
+	const HashAlgorithm algorithm(wanted_hash_algorithm(old_info));
+	Information * f(file_info_cache.find(name));
+	if (!f)
+		return file_info_cache.insert(name, read_file_info(paths.str(name), old_info, algorithm));
+	if (f->FILE == f->type && algorithm != f->hash_algorithm)
+		*f = read_file_info(paths.str(name), old_info, algorithm);
+	return *f;
+}
+
+/* Batched hashing of small files *******************************************
+// **************************************************************************
+*/
+
+// Small files are read whole into memory and hashed several at a time in the lanes of the vector unit.
+// Larger files gain nothing from this, and are hashed one at a time as they are found.
+enum { MAX_BATCHED_HASH_SIZE = 64 * 1024 };
+
+
+/// Read the whole file, noting whether it was the expected version throughout.
+static inline
+bool
+read_whole_file (
+	const std::string & name,
+	std::vector<unsigned char> & contents,
+	const struct stat & expected,
+	bool & unchanged
+) {
+#if defined(__OS2__) || defined(__WIN32__) || defined(__NT__)
+	const int fd(open(name.c_str(), O_RDONLY|O_BINARY));
+#else
+	const int fd(open(name.c_str(), O_RDONLY|O_NOCTTY));
+#endif
+	if (0 > fd) return false;
+	std::size_t length(0);
+	for (;;) {
+		if (contents.size() < length + 4096U)
+			contents.resize(length + 4096U);
+		const int n(read(fd, &contents[length], contents.size() - length));
+		if (0 > n) {
+			close(fd);
+			return false;
+		}
+		if (0 == n) break;
+		length += static_cast<std::size_t>(n);
+	}
+	struct stat after;
+	unchanged = 0 <= fstat(fd, &after) && same_file_version(expected, after);
+	close(fd);
+	contents.resize(length);
+	return true;
+}
+
+/// Obtain the information about several files at once, so that small files can be hashed together.
+static
+void
+read_file_infos (
+	const FileInfoRequest * requests,
+	std::size_t count,
+	Information * results
+) {
+	HashingTimer timer;
+	const bool multi_buffer(MultiBufferCubeHashSHA3AHS256::available());
+	std::vector<Information *> pending;
+	std::vector<struct stat> pending_versions;
+	std::vector<bool> pending_unchanged;
+	std::list<std::vector<unsigned char> > contents;
+	for (const FileInfoRequest * r(requests); r != requests + count; ++r) {
+		const std::string name(paths.str(r->name));
+		const HashAlgorithm algorithm(wanted_hash_algorithm(r->old_info));
+		Information i;
+		struct stat stbuf;
+		bool needs_hash(true);
+		if (r->stated) {
+			i = r->info;
+			stbuf = r->version;
+		} else
+			needs_hash = stat_file_info(name, r->old_info, algorithm, i, stbuf) && !lookup_cached_hash(stbuf, algorithm, i.hash);
+		std::vector<unsigned char> buf;
+		bool unchanged(false);
+		// Only CubeHash has a multiple-buffer implementation.
+		const bool batched(needs_hash && multi_buffer && CUBEHASH == algorithm && MAX_BATCHED_HASH_SIZE >= stbuf.st_size && read_whole_file(name, buf, stbuf, unchanged));
+		if (needs_hash && !batched)
+			hash_file(name, i, stbuf);
+		Information & cached(results[r - requests] = i);
+		if (batched) {
+			pending.push_back(&cached);
+			pending_versions.push_back(stbuf);
+			pending_unchanged.push_back(unchanged);
+			contents.push_back(std::vector<unsigned char>());
+			contents.back().swap(buf);
+		}
+	}
+	std::vector<MultiBufferCubeHashSHA3AHS256::Message> messages(pending.size());
+	std::list<std::vector<unsigned char> >::iterator c(contents.begin());
+	for (std::size_t j(0); j < pending.size(); ++j, ++c) {
+		messages[j].data = c->empty() ? 0 : &c->front();
+		messages[j].length = c->size();
+		count_hashed_bytes(c->size());
+		messages[j].hashval = pending[j]->hash;
+	}
+	if (!messages.empty())
+		MultiBufferCubeHashSHA3AHS256::hash(&messages.front(), messages.size());
+	for (std::size_t j(0); j < pending.size(); ++j)
+		if (pending_unchanged[j])
+			store_cached_hash(pending_versions[j], CUBEHASH, pending[j]->hash);
+}
+
+/// Populate the cache for all of the named files at once, so that small files can be hashed together.
+static
+void
+batch_file_info (
+	const FileInfoRequests & requests
+) {
+	FileInfoRequests uncached;
+	for (FileInfoRequests::const_iterator r(requests.begin()); r != requests.end(); ++r)
+		if (!file_info_cache.find(r->name))
+			uncached.push_back(*r);
+	if (uncached.empty()) return;
+	std::vector<Information> results(uncached.size());
+	if (uncached.size() < 2U || !served_file_infos(&uncached.front(), uncached.size(), &results.front()))
+		read_file_infos(&uncached.front(), uncached.size(), &results.front());
+	for (std::size_t j(0); j < uncached.size(); ++j)
+		if (!file_info_cache.find(uncached[j].name))
+			file_info_cache.insert(uncached[j].name, results[j]);
+}
+
+static inline
+void
+delete_file_info (
+	PathID name
+) {
+	file_info_cache.erase(name);
+}
+
+/* Parsing and updating of the .redo database *******************************
+// **************************************************************************
+*/
+
+// The text format is parsed directly from a buffer holding the whole file, without any iostreams or memory allocation.
+// Names are returned as pointers into the buffer.
+
+class HexDigits {
+public:
+	enum { NOT_A_DIGIT = 0xFF };
+	HexDigits()
+	{
+		std::memset(values, NOT_A_DIGIT, sizeof values);
+		for (unsigned char c('0'); c <= '9'; ++c) values[c] = static_cast<unsigned char>(c - '0');
+		for (unsigned char c('a'); c <= 'f'; ++c) values[c] = static_cast<unsigned char>(c - 'a' + 10);
+		for (unsigned char c('A'); c <= 'F'; ++c) values[c] = static_cast<unsigned char>(c - 'A' + 10);
+	}
+	unsigned char operator [] (char c) const { return values[static_cast<unsigned char>(c)]; }
+protected:
+	unsigned char values[UCHAR_MAX + 1];
+};
+
+static const HexDigits hex_digits;
+
+static inline
+void
+skip_blanks (
+	const char * & p,
+	const char * end
+) {
+	while (p < end && (' ' == *p || '\t' == *p))
+		++p;
+}
+
+static inline
+void
+skip_line (
+	const char * & p,
+	const char * end
+) {
+	const void * nl(std::memchr(p, '\n', static_cast<std::size_t>(end - p)));
+	p = nl ? static_cast<const char *>(nl) + 1 : end;
+}
+
+/// Parse a hexadecimal number, returning false if there are no digits.
+static inline
+bool
+parse_hex (
+	const char * & p,
+	const char * end,
+	uint64_t & value
+) {
+	const char * const start(p);
+	value = 0U;
+	for (unsigned char d; p < end && HexDigits::NOT_A_DIGIT != (d = hex_digits[*p]); ++p)
+		value = (value << 4U) | d;
+	return p != start;
+}
+
+/// Parse a run of hexadecimal digit pairs into bytes, returning false if there are too few.
+static inline
+bool
+parse_hex_bytes (
+	const char * & p,
+	const char * end,
+	unsigned char * bytes,
+	std::size_t count
+) {
+	if (static_cast<std::size_t>(end - p) < 2U * count) return false;
+	unsigned char bad(0U);
+	for (std::size_t j(0); j < count; ++j, p += 2) {
+		const unsigned char h(hex_digits[p[0]]), l(hex_digits[p[1]]);
+		bad |= h | l;
+		bytes[j] = static_cast<unsigned char>((h << 4U) | (l & 0x0FU));
+	}
+	return !(bad & 0xF0U);
+}
+
+/// Parse one line, returning false if it was a header that sets the hash algorithm for the subsequent records rather than a record.
+static inline
+bool
+parse_db_line (
+	const char * & p,
+	const char * end,
+	HashAlgorithm & algorithm,
+	Information & i,
+	const char * & name,
+	std::size_t & name_length
+) {
+	i.hash_algorithm = algorithm;
+	i.last_written = -1;
+	i.last_written_nsec = 0;
+	i.size = i.inode = 0U;
+	i.has_fingerprint = false;
+	clear_hash(i);
+	switch (p < end ? *p++ : 'a') {
+		default:
+		case 'a':
+			i.type = i.NOTHING;
+			break;
+		case 'n':
+			i.type = i.NO_DO_FILE;
+			break;
+		case 's':
+			i.type = i.SPECIAL;
+			goto atime;
+		case 'd':
+			i.type = i.DIRECTORY;
+			goto atime;
+		case 'f':
+			i.type = i.FILE;
+			skip_blanks(p, end);
+			parse_hex_bytes(p, end, i.hash, sizeof i.hash);
+			goto atime;
+		case 'h':
+		{
+			const char * const start(p);
+			skip_line(p, end);
+			const char * e(p);
+			if (e > start && '\n' == e[-1]) --e;
+			algorithm = parse_hash_algorithm(start, static_cast<std::size_t>(e - start));
+			return false;
+		}
+		atime:
+		{
+			skip_blanks(p, end);
+			uint64_t v;
+			parse_hex(p, end, v);
+			i.last_written = static_cast<std::time_t>(v);
+			// The rest of the fingerprint is absent from databases written by older versions.
+			if (p < end && '.' == *p) {
+				++p;
+				bool ok(parse_hex(p, end, v));
+				i.last_written_nsec = static_cast<long>(v);
+				if (p < end && ',' == *p) { ++p; ok = parse_hex(p, end, i.size) && ok; }
+				if (p < end && ',' == *p) { ++p; ok = parse_hex(p, end, i.inode) && ok; }
+				i.has_fingerprint = ok;
+			}
+			break;
+		}
+		// FIXME: Delete this special case once we switch to the new .redo database filenames.
+		case '\n':
+		case '\t':
+		case '\f':
+		case '\b':
+		case '\v':
+		case '\r':
+		case ' ':
+		{
+			// The name, the timestamp, and an MD5 hash that cannot be compared with anything.
+			i.type = i.FILE;
+			while (p < end && std::isspace(static_cast<unsigned char>(*p))) ++p;
+			name = p;
+			while (p < end && !std::isspace(static_cast<unsigned char>(*p))) ++p;
+			name_length = static_cast<std::size_t>(p - name);
+			skip_blanks(p, end);
+			uint64_t v;
+			parse_hex(p, end, v);
+			i.last_written = static_cast<std::time_t>(v);
+			skip_line(p, end);
+			return true;
+		}
+	}
+	skip_blanks(p, end);
+	name = p;
+	skip_line(p, end);
+	name_length = static_cast<std::size_t>(p - name);
+	if (name_length && '\n' == name[name_length - 1]) --name_length;
+	return true;
+}
+
+/// The fingerprint is the modification timestamp, followed by the nanoseconds, size, and inode number: "seconds.nanoseconds,size,inode" all in hexadecimal.
+static inline
+std::ostream &
+put_fingerprint (
+	std::ostream & s,
+	const Information & info
+) {
+	s << std::hex << info.last_written;
+	if (info.has_fingerprint)
+		s << '.' << info.last_written_nsec << ',' << info.size << ',' << info.inode;
+	return s << std::dec;
+}
+
+static inline
+void
+write_db_line (
+	std::ostream & s,
+	const Information & info,
+	const char * name
+) {
+	switch (info.type) {
+		case Information::NOTHING:	s.put('a') << name << '\n'; break;
+		case Information::NO_DO_FILE:	s.put('n') << name << '\n'; break;
+		case Information::SPECIAL:	s.put('s'); put_fingerprint(s, info) << ' ' << name << '\n'; break;
+		case Information::DIRECTORY:	s.put('d'); put_fingerprint(s, info) << ' ' << name << '\n'; break;
+		case Information::FILE:
+			s.put('f') << std::hex << std::setfill('0');
+			for ( std::size_t j(0);j < (sizeof info.hash/sizeof *info.hash); ++j)
+				s << std::setw(2) << static_cast<unsigned int>(info.hash[j]);
+			s << std::setfill(' ') << std::dec << ' ';
+			put_fingerprint(s, info) << ' ' << name << '\n';
+			break;
+	}
+}
+
+static inline
+void
+puthash (
+	std::ostream & s,
+	const Information & info
+) {
+	s << std::hex << std::setfill('0');
+	for ( std::size_t j(0);j < sizeof info.hash/sizeof *info.hash; ++j)
+		s << std::setw(2) << static_cast<unsigned int>(info.hash[j]);
+	s << std::setfill(' ') << std::dec;
+}
+
+/// The cubehash utility's output, which keeps the form of the original text database, with the modification time to the second, in hexadecimal.
+static inline
+void
+write_hash_line (
+	std::ostream & s,
+	const Information & info,
+	const char * name
+) {
+	switch (info.type) {
+		case Information::NOTHING:	s.put('a') << name << '\n'; break;
+		case Information::NO_DO_FILE:	s.put('n') << name << '\n'; break;
+		case Information::SPECIAL:	s.put('s') << std::hex << info.last_written << ' ' << std::dec << name << '\n'; break;
+		case Information::DIRECTORY:	s.put('d') << std::hex << info.last_written << ' ' << std::dec << name << '\n'; break;
+		case Information::FILE:
+			s.put('f');
+			puthash(s, info);
+			s << ' ' << std::hex << info.last_written << ' ' << std::dec << name << '\n';
+			break;
+	}
+}
+
+/* The binary .redo database format *****************************************
+// **************************************************************************
+*/
+
+// A database is a header followed by a sequence of records, each of which is a fixed-size record header, then the raw hash, then the name.
+// Records are padded to a multiple of 8 bytes, so that every record header is aligned when the file is mapped into memory, and can be used in place.
+// Numbers are in native byte order; a database with a foreign byte order or an unknown version is treated as unreadable, which just causes its target to be rebuilt.
+// Databases in the older text format are still read, and are replaced by the binary format whenever their targets are next rebuilt.
+
+struct DatabaseHeader {
+	char magic[8];
+	uint32_t byte_order;
+	uint32_t version;
+	uint32_t hash_algorithm;
+	uint32_t reserved;
+};
+
+struct DatabaseRecordHeader {
+	uint8_t type;		///< as in the text format: 'a', 'n', 's', 'd', or 'f'
+	uint8_t flags;
+	uint16_t hash_length;	///< 32 for files, and 0 for everything else
+	uint32_t name_length;
+	int64_t last_written;
+	uint32_t last_written_nsec;
+	uint32_t reserved;
+	uint64_t size;
+	uint64_t inode;
+};
+
+enum { DATABASE_VERSION = 1U, DATABASE_BYTE_ORDER = 0x01020304U };
+enum { DATABASE_HAS_FINGERPRINT = 0x01U };
+// No text database can begin with a DEL character.
+static const char database_magic[8] = { '\x7f', 'r', 'e', 'd', 'o', 'd', 'b', '\n' };
+
+static inline
+void
+put_db_header (
+	std::string & s,
+	HashAlgorithm algorithm
+) {
+	DatabaseHeader h;
+	std::memset(&h, 0, sizeof h);
+	std::memcpy(h.magic, database_magic, sizeof h.magic);
+	h.byte_order = DATABASE_BYTE_ORDER;
+	h.version = DATABASE_VERSION;
+	h.hash_algorithm = static_cast<uint32_t>(algorithm);
+	s.append(reinterpret_cast<const char *>(&h), sizeof h);
+}
+
+static inline
+void
+put_db_record (
+	std::string & s,
+	const Information & info,
+	const char * name
+) {
+	DatabaseRecordHeader r;
+	std::memset(&r, 0, sizeof r);
+	switch (info.type) {
+		case Information::NOTHING:	r.type = 'a'; break;
+		case Information::NO_DO_FILE:	r.type = 'n'; break;
+		case Information::SPECIAL:	r.type = 's'; break;
+		case Information::DIRECTORY:	r.type = 'd'; break;
+		case Information::FILE:		r.type = 'f'; r.hash_length = sizeof info.hash; break;
+	}
+	const std::size_t name_length(std::strlen(name));
+	r.flags = info.has_fingerprint ? static_cast<uint8_t>(DATABASE_HAS_FINGERPRINT) : 0U;
+	r.name_length = static_cast<uint32_t>(name_length);
+	r.last_written = static_cast<int64_t>(info.last_written);
+	r.last_written_nsec = static_cast<uint32_t>(info.last_written_nsec);
+	r.size = info.size;
+	r.inode = info.inode;
+	const std::size_t length(sizeof r + r.hash_length + name_length);
+	s.append(reinterpret_cast<const char *>(&r), sizeof r);
+	s.append(reinterpret_cast<const char *>(info.hash), r.hash_length);
+	s.append(name, name_length);
+	s.append(database_padded(length) - length, '\0');
+}
+
+/* The single-file log database *********************************************
+// **************************************************************************
+*/
+
+// Optionally, instead of a tree of .prereqs files mirroring the source tree, every target's database is kept in the one file .redo/database.log.
+// It is selected by the existence of that file, which redo --log-database creates, migrating any existing tree of databases into it.
+//
+// The log is a sequence of records, each a header then the target name then a payload, padded to 8 bytes.
+// A BEGIN record marks a target as a target when its first build starts; a COMMIT record carries a complete database, in the same form as a .prereqs file, and supersedes any earlier one for the same target.
+// Each record is appended with a single write() to a file opened O_APPEND, which makes committing a target atomic, as renaming a .prereqs file is.
+// Records carry a checksum; a torn record left by a crash is skipped once intact records are found after it, or once no append is in progress.
+// An index of the latest record for each target is built by scanning the log, and extended by scanning whatever has since been appended.
+//
+// Per-target locks are byte-range locks on .redo/database.lock, at offsets given by a 62-bit hash of the target name.
+// Byte 0 of the lock file arbitrates compaction: appenders hold a read lock on it whilst they append, and the compactor a write lock whilst it rewrites the log.
+// Because all fcntl() locks that a process holds on a file are dropped when any descriptor for it is closed, the lock file is opened only once per process.
+
+#if !defined(__OS2__) && !defined(__WIN32__) && !defined(__NT__)
+class LogDatabase {
+public:
+	LogDatabase() : fd(-1), lock_fd(-1), data(0), mapped_length(0), scanned(0), live(0), checked(false), sequence(0U) {}
+	~LogDatabase();
+	bool enabled();
+	bool create(const char * prog);
+	bool lock(const char * prog, const std::string & target, bool wait, bool & busy);
+	void unlock(const std::string & target);
+	bool begin(const char * prog, const std::string & target) { return append(prog, BEGIN, target, 0, 0U); }
+	bool commit(const char * prog, const std::string & target, const std::string & database) { return append(prog, COMMIT, target, database.data(), database.length()); }
+	bool known(const std::string & target);
+	bool find(const std::string & target, std::vector<char> & database);
+	void compact(const char * prog);
+	std::string temporary_name();
+protected:
+	enum { MAGIC = 0x676f4c52U, BEGIN = 1U, COMMIT = 2U, MIN_COMPACTION_SIZE = 1024 * 1024 };
+	struct RecordHeader {
+		uint32_t magic;
+		uint32_t type;
+		uint32_t name_length;
+		uint32_t payload_length;
+		uint32_t check;
+		uint32_t reserved;
+	};
+	struct Entry {
+		uint64_t payload_offset;	///< zero for a target that has begun but not yet been committed
+		std::size_t payload_length, record_length;
+	};
+	typedef std::map<std::string, Entry> Index;
+	int fd, lock_fd;
+	const char * data;
+	std::size_t mapped_length, scanned, live;
+	bool checked;
+	unsigned long sequence;
+	Index index;
+
+	bool open_files(int flags);
+	void close_log();
+	void reopen_if_replaced();
+	void refresh();
+	bool intact_record_after(std::size_t offset) const;
+	bool abandoned_tail();
+	bool append(const char * prog, uint32_t type, const std::string & target, const char * payload, std::size_t payload_length);
+	bool lock_compaction(short type, int command);
+	static void make_record(std::string &, uint32_t type, const std::string & target, const char * payload, std::size_t payload_length);
+	static off_t lock_offset(const std::string &);
+	static int migrate_cb(const char *, const struct stat *, int, struct FTW *);
+	static std::vector<std::string> * migrating;
+};
+
+std::vector<std::string> * LogDatabase::migrating(0);
+
+LogDatabase::~LogDatabase()
+{
+	close_log();
+	if (-1 != lock_fd) close(lock_fd);
+}
+
+bool
+LogDatabase::enabled()
+{
+	if (!checked) {
+		checked = true;
+		open_files(0);
+	}
+	return -1 != fd;
+}
+
+bool
+LogDatabase::open_files(
+	int flags
+) {
+	fd = open(".redo/database.log", O_RDWR|O_APPEND|O_NOCTTY|flags, 0666);
+	if (0 > fd) return false;
+	if (-1 == lock_fd)
+		lock_fd = open(".redo/database.lock", O_RDWR|O_CREAT|O_NOCTTY, 0666);
+	if (0 > lock_fd) {
+		close_log();
+		return false;
+	}
+	return true;
+}
+
+void
+LogDatabase::close_log()
+{
+	if (data) munmap(const_cast<char *>(data), mapped_length);
+	if (-1 != fd) close(fd);
+	fd = -1;
+	data = 0;
+	mapped_length = scanned = live = 0;
+	index.clear();
+}
+
+off_t
+LogDatabase::lock_offset(
+	const std::string & target
+) {
+	const uint64_t h(fnv1a_64(target.data(), target.length()));
+	const uint64_t mask(sizeof(off_t) > 4U ? 0x3FFFFFFFFFFFFFFFULL : 0x3FFFFFFFULL);
+	return static_cast<off_t>(1U + (h & mask));
+}
+
+void
+LogDatabase::make_record(
+	std::string & s,
+	uint32_t type,
+	const std::string & target,
+	const char * payload,
+	std::size_t payload_length
+) {
+	RecordHeader h;
+	std::memset(&h, 0, sizeof h);
+	h.magic = MAGIC;
+	h.type = type;
+	h.name_length = static_cast<uint32_t>(target.length());
+	h.payload_length = static_cast<uint32_t>(payload_length);
+	const std::size_t start(s.length());
+	s.append(reinterpret_cast<const char *>(&h), sizeof h);
+	s.append(target);
+	s.append(payload ? payload : "", payload_length);
+	RecordFile::seal(s, start, offsetof(RecordHeader, check));
+}
+
+/// A compaction by another process may have renamed a new log over the one that is open, whose index is then stale.
+void
+LogDatabase::reopen_if_replaced()
+{
+	struct stat a, b;
+	if (0 <= fstat(fd, &a) && 0 <= stat(".redo/database.log", &b) && (a.st_dev != b.st_dev || a.st_ino != b.st_ino)) {
+		close_log();
+		open_files(0);
+	}
+}
+
+/// Map and index whatever has been appended to the log since it was last scanned.
+void
+LogDatabase::refresh()
+{
+	reopen_if_replaced();
+	struct stat stbuf;
+	if (0 > fstat(fd, &stbuf)) return;
+	const std::size_t length(static_cast<std::size_t>(stbuf.st_size));
+	if (length > mapped_length) {
+		if (data) munmap(const_cast<char *>(data), mapped_length);
+		void * p(mmap(0, length, PROT_READ, MAP_SHARED, fd, 0));
+		if (MAP_FAILED == p) {
+			data = 0;
+			mapped_length = scanned = live = 0;
+			index.clear();
+			return;
+		}
+		data = static_cast<const char *>(p);
+		mapped_length = length;
+	}
+	while (scanned + sizeof(RecordHeader) <= mapped_length) {
+		RecordHeader h;
+		std::memcpy(&h, data + scanned, sizeof h);
+		if (MAGIC != h.magic || (BEGIN != h.type && COMMIT != h.type)) {
+			++scanned;
+			continue;
+		}
+		const uint64_t record_length(database_padded(sizeof h + uint64_t(h.name_length) + h.payload_length));
+		const bool runs_off(scanned + record_length > mapped_length);
+		if (runs_off || !RecordFile::intact(reinterpret_cast<const unsigned char *>(data + scanned), static_cast<std::size_t>(record_length), offsetof(RecordHeader, check))) {
+			// A bad record at the tail might still be being written, unless intact records follow it or no append is in progress.
+			if ((runs_off || scanned + record_length == mapped_length) && !intact_record_after(scanned) && !abandoned_tail()) break;
+			++scanned;
+			continue;
+		}
+		const std::string target(data + scanned + sizeof h, h.name_length);
+		Index::iterator i(index.find(target));
+		if (COMMIT == h.type) {
+			if (index.end() == i)
+				i = index.insert(Index::value_type(target, Entry())).first;
+			else
+				live -= i->second.record_length;
+			i->second.payload_offset = scanned + sizeof h + h.name_length;
+			i->second.payload_length = h.payload_length;
+			i->second.record_length = static_cast<std::size_t>(record_length);
+			live += i->second.record_length;
+		} else
+		if (index.end() == i) {
+			Entry & e(index[target]);
+			e.payload_offset = 0U;
+			e.payload_length = 0U;
+			e.record_length = static_cast<std::size_t>(record_length);
+			live += e.record_length;
+		}
+		scanned += static_cast<std::size_t>(record_length);
+	}
+}
+
+/// Whether an intact record starts anywhere in the mapped log after the given offset.
+bool
+LogDatabase::intact_record_after(
+	std::size_t offset
+) const {
+	for (std::size_t o(offset + 1U); o + sizeof(RecordHeader) <= mapped_length; ++o) {
+		RecordHeader h;
+		std::memcpy(&h, data + o, sizeof h);
+		if (MAGIC != h.magic || (BEGIN != h.type && COMMIT != h.type)) continue;
+		const uint64_t record_length(database_padded(sizeof h + uint64_t(h.name_length) + h.payload_length));
+		if (o + record_length > mapped_length) continue;
+		if (RecordFile::intact(reinterpret_cast<const unsigned char *>(data + o), static_cast<std::size_t>(record_length), offsetof(RecordHeader, check)))
+			return true;
+	}
+	return false;
+}
+
+/// Whether a bad record at the tail of the log was left by an append that died, rather than one still in progress.
+/// Appenders hold a read lock on byte 0 of the lock file throughout their write(), so if no other process holds a lock there and the log has not grown since it was mapped, nothing is still writing it.
+bool
+LogDatabase::abandoned_tail()
+{
+	struct flock lock;
+	lock.l_whence = SEEK_SET;
+	lock.l_start = 0;
+	lock.l_len = 1;
+	lock.l_type = F_WRLCK;
+	if (0 > fcntl(lock_fd, F_GETLK, &lock) || F_UNLCK != lock.l_type) return false;
+	struct stat stbuf;
+	return 0 <= fstat(fd, &stbuf) && static_cast<std::size_t>(stbuf.st_size) <= mapped_length;
+}
+
+bool
+LogDatabase::lock_compaction(
+	short type,
+	int command
+) {
+	struct flock lock;
+	lock.l_whence = SEEK_SET;
+	lock.l_start = 0;
+	lock.l_len = 1;
+	lock.l_type = type;
+	return 0 <= fcntl(lock_fd, command, &lock);
+}
+
+bool
+LogDatabase::append(
+	const char * prog,
+	uint32_t type,
+	const std::string & target,
+	const char * payload,
+	std::size_t payload_length
+) {
+	std::string record;
+	make_record(record, type, target, payload, payload_length);
+	if (!lock_compaction(F_RDLCK, F_SETLKW)) {
+		const int error(errno);
+		msg(prog, "ERROR") << ".redo/database.lock: " << std::strerror(error) << "\n";
+		return false;
+	}
+	reopen_if_replaced();
+	const bool ok(-1 != fd && static_cast<ssize_t>(record.length()) == write(fd, record.data(), record.length()));
+	const int error(errno);
+	lock_compaction(F_UNLCK, F_SETLK);
+	if (!ok) {
+		msg(prog, "ERROR") << ".redo/database.log: " << std::strerror(error) << "\n";
+		return false;
+	}
+	return true;
+}
+
+bool
+LogDatabase::known(
+	const std::string & target
+) {
+	refresh();
+	return index.end() != index.find(target);
+}
+
+bool
+LogDatabase::find(
+	const std::string & target,
+	std::vector<char> & database
+) {
+	refresh();
+	Index::const_iterator i(index.find(target));
+	if (index.end() == i || !i->second.payload_offset) return false;
+	database.assign(data + i->second.payload_offset, data + i->second.payload_offset + i->second.payload_length);
+	return true;
+}
+
+bool
+LogDatabase::lock(
+	const char * prog,
+	const std::string & target,
+	bool wait,
+	bool & busy
+) {
+	if (debug) {
+		msg(prog, "INFO") << target << ": Locking ...\n";
+	}
+	struct flock lock;
+	lock.l_whence = SEEK_SET;
+	lock.l_start = lock_offset(target);
+	lock.l_len = 1;
+	lock.l_type = F_WRLCK;
+	busy = false;
+	if (0 > fcntl(lock_fd, wait ? F_SETLKW : F_SETLK, &lock)) {
+		const int error(errno);
+		if (!wait && (EAGAIN == error || EACCES == error)) {
+			busy = true;
+			return false;
+		}
+		msg(prog, "ERROR") << target << ": " << std::strerror(error) << "\n";
+		return false;
+	}
+	return true;
+}
+
+void
+LogDatabase::unlock(
+	const std::string & target
+) {
+	struct flock lock;
+	lock.l_whence = SEEK_SET;
+	lock.l_start = lock_offset(target);
+	lock.l_len = 1;
+	lock.l_type = F_UNLCK;
+	fcntl(lock_fd, F_SETLK, &lock);
+}
+
+std::string
+LogDatabase::temporary_name()
+{
+	std::ostringstream s;
+	s << ".redo/database.build." << getpid() << "." << ++sequence;
+	return s.str();
+}
+
+/// Rewrite the log with just the latest record for each target, if enough of it is superseded or unreadable.
+void
+LogDatabase::compact(
+	const char * prog
+) {
+	refresh();
+	if (!data || ((mapped_length < MIN_COMPACTION_SIZE || mapped_length <= 2U * live) && scanned == mapped_length)) return;
+	// Someone else compacting, or appending, is a reason not to compact now.
+	if (!lock_compaction(F_WRLCK, F_SETLK)) return;
+	refresh();
+	std::string all;
+	for (Index::const_iterator i(index.begin()); i != index.end(); ++i) {
+		if (i->second.payload_offset)
+			make_record(all, COMMIT, i->first, data + i->second.payload_offset, i->second.payload_length);
+		else
+			make_record(all, BEGIN, i->first, 0, 0U);
+	}
+	if (RecordFile::replace(".redo/database.log", all)) {
+		if (debug)
+			msg(prog, "INFO") << ".redo/database.log: Compacted from " << mapped_length << " to " << all.length() << " bytes.\n";
+		close_log();
+		open_files(0);
+	}
+	lock_compaction(F_UNLCK, F_SETLK);
+}
+
+int
+LogDatabase::migrate_cb(
+	const char * fpath,
+	const struct stat *,
+	int typeflag,
+	struct FTW *
+) {
+	if (FTW_F == typeflag || FTW_DP == typeflag)
+		migrating->push_back(fpath);
+	return 0;
+}
+
+/// Create the log, and move any existing tree of databases into it.
+bool
+LogDatabase::create(
+	const char * prog
+) {
+	checked = true;
+	if (-1 != fd || open_files(0)) return true;
+	if (!open_files(O_CREAT|O_EXCL)) {
+		if (EEXIST != errno || !open_files(0)) {
+			const int error(errno);
+			msg(prog, "ERROR") << ".redo/database.log: " << std::strerror(error) << "\n";
+			return false;
+		}
+		return true;
+	}
+	std::vector<std::string> paths;
+	migrating = &paths;
+	nftw(".redo", migrate_cb, 64, FTW_DEPTH | FTW_PHYS);
+	migrating = 0;
+	static const char prefix[] = ".redo/", suffix[] = ".prereqs";
+	const std::size_t prefix_length(sizeof prefix - 1), suffix_length(sizeof suffix - 1);
+	for (std::vector<std::string>::const_iterator i(paths.begin()); i != paths.end(); ++i) {
+		const std::string & path(*i);
+		if (path.length() <= prefix_length + suffix_length || 0 != path.compare(path.length() - suffix_length, suffix_length, suffix))
+			continue;
+		std::ifstream f(path.c_str(), std::ios::binary);
+		const std::string database((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+		if (f.bad() || !commit(prog, path.substr(prefix_length, path.length() - prefix_length - suffix_length), database))
+			return false;
+		std::remove(path.c_str());
+		std::remove((path + ".lock").c_str());
+	}
+	// Only the now-empty directories of the mirrored tree will be removed.
+	for (std::vector<std::string>::const_iterator i(paths.begin()); i != paths.end(); ++i)
+		if (".redo" != *i)
+			rmdir(i->c_str());
+	return true;
+}
+#else
+class LogDatabase {
+public:
+	bool enabled() { return false; }
+	bool create(const char * prog) { msg(prog, "ERROR") << "The log database is not available on this platform.\n"; return false; }
+	bool lock(const char *, const std::string &, bool, bool &) { return false; }
+	void unlock(const std::string &) {}
+	bool begin(const char *, const std::string &) { return false; }
+	bool commit(const char *, const std::string &, const std::string &) { return false; }
+	bool known(const std::string &) { return false; }
+	bool find(const std::string &, std::vector<char> &) { return false; }
+	void compact(const char *) {}
+	std::string temporary_name() { return std::string(); }
+};
+#endif
+
+static LogDatabase log_database;
+
+/* The index of targets *****************************************************
+// **************************************************************************
+*/
+
+#if !defined(__OS2__) && !defined(__WIN32__) && !defined(__NT__)
+// With a tree of databases, every name that has ever been a target is listed in .redo/targets, so that telling targets from source files does not need to probe for databases.
+// Names are only ever appended, each terminated by a NUL, from when a target's first build starts.
+// An existing tree of databases without the file is scanned for databases to create it, which is then linked into place atomically so that no name appended by another process can be lost.
+class TargetIndex {
+public:
+	TargetIndex() : fd(-1), offset(0), loaded(false) {}
+	~TargetIndex() { if (-1 != fd) close(fd); }
+	bool enabled() { if (!loaded) load(); return -1 != fd; }
+	bool known(PathID);
+	void add(PathID);
+protected:
+	typedef std::vector<bool> Names;	///< indexed by path ID
+	int fd;
+	off_t offset;
+	bool loaded;
+	Names names;
+	std::string partial;
+	static int scan_cb(const char *, const struct stat *, int, struct FTW *);
+	static std::vector<std::string> * scanning;
+	static bool find(const Names & n, PathID id) { return id < n.size() && n[id]; }
+	void load();
+	bool open_index();
+	void create();
+	void refresh();
+};
+
+std::vector<std::string> * TargetIndex::scanning(0);
+
+int
+TargetIndex::scan_cb(
+	const char * fpath,
+	const struct stat *,
+	int typeflag,
+	struct FTW *
+) {
+	if (FTW_F != typeflag) return 0;
+	static const char * const suffixes[] = { ".prereqs", ".prereqsne", ".prereqs.build", ".prereqsne.build" };
+	static const char prefix[] = ".redo/";
+	const std::size_t prefix_length(sizeof prefix - 1), len(std::strlen(fpath));
+	for (std::size_t j(0); j < sizeof suffixes/sizeof *suffixes; ++j) {
+		const std::size_t suffix_length(std::strlen(suffixes[j]));
+		if (len > prefix_length + suffix_length && 0 == std::strcmp(fpath + len - suffix_length, suffixes[j])) {
+			scanning->push_back(std::string(fpath + prefix_length, len - prefix_length - suffix_length));
+			break;
+		}
+	}
+	return 0;
+}
+
+bool
+TargetIndex::open_index()
+{
+	fd = open(".redo/targets", O_RDWR|O_APPEND|O_NOCTTY);
+	return -1 != fd;
+}
+
+void
+TargetIndex::create()
+{
+	std::vector<std::string> found;
+	scanning = &found;
+	nftw(".redo", scan_cb, 64, FTW_PHYS);
+	scanning = 0;
+	std::string contents;
+	for (std::vector<std::string>::const_iterator i(found.begin()); i != found.end(); ++i) {
+		contents += *i;
+		contents += '\0';
+	}
+	std::ostringstream new_name;
+	new_name << ".redo/targets.new." << getpid();
+	const int new_fd(open(new_name.str().c_str(), O_WRONLY|O_TRUNC|O_CREAT|O_NOCTTY, 0666));
+	if (0 > new_fd) return;
+	const bool ok(contents.empty() || static_cast<ssize_t>(contents.length()) == write(new_fd, contents.data(), contents.length()));
+	close(new_fd);
+	// If another process has linked its index into place first, that one is used instead.
+	if (ok) link(new_name.str().c_str(), ".redo/targets");
+	std::remove(new_name.str().c_str());
+}
+
+void
+TargetIndex::load()
+{
+	loaded = true;
+	// There are no targets at all until the database directory exists, so the index is not created until then.
+	if (log_database.enabled() || 0 > access(".redo", F_OK)) return;
+	if (!open_index()) {
+		if (ENOENT != errno) return;
+		create();
+		if (!open_index()) return;
+	}
+	refresh();
+}
+
+/// Read whatever other processes have appended since the last time.
+void
+TargetIndex::refresh()
+{
+	char buf[65536];
+	for (;;) {
+		const ssize_t n(pread(fd, buf, sizeof buf, offset));
+		if (0 >= n) break;
+		offset += n;
+		for (const char * p(buf), * const end(buf + n); p < end; ) {
+			const char * nul(static_cast<const char *>(std::memchr(p, '\0', static_cast<std::size_t>(end - p))));
+			if (!nul) {
+				partial.append(p, end);
+				break;
+			}
+			partial.append(p, nul);
+			const PathID id(paths.intern(partial));
+			if (id >= names.size()) names.resize(id + 1U, false);
+			names[id] = true;
+			partial.clear();
+			p = nul + 1;
+		}
+	}
+}
+
+bool
+TargetIndex::known(
+	PathID id
+) {
+	if (!loaded) load();
+	if (find(names, id)) return true;
+	if (-1 == fd) return false;
+	// Another process might have just started building the target for the first time.
+	refresh();
+	return find(names, id);
+}
+
+void
+TargetIndex::add(
+	PathID id
+) {
+	// The database directory might have only just been created.
+	if (-1 == fd) load();
+	if (-1 == fd || known(id)) return;
+	std::string record(paths.name(id), paths.length(id));
+	record += '\0';
+	write(fd, record.data(), record.length());
+}
+#else
+class TargetIndex {
+public:
+	bool enabled() { return false; }
+	bool known(PathID) { return false; }
+	void add(PathID) {}
+};
+#endif
+
+static TargetIndex target_index;
+
+/* Reading databases ********************************************************
+// **************************************************************************
+*/
+
+/// Read the records of a database in either format, mapping it into memory where possible.
+class DatabaseReader {
+public:
+	enum Source { TARGET, FILE_NAME };
+	DatabaseReader(const std::string & name, Source source = TARGET);
+	~DatabaseReader();
+	bool fail() const { return failed; }
+	bool corrupt() const { return is_corrupt; }
+	HashAlgorithm hash_algorithm() const { return algorithm; }
+	bool next(Information &, const char * & name, std::size_t & name_length);
+	bool next(Information &, std::string &);
+protected:
+	const char * data;
+	std::size_t length, offset;
+	bool failed, mapped, is_binary, is_corrupt;
+	HashAlgorithm algorithm;
+	std::vector<char> buffer;
+	bool map_file(const std::string &);
+	bool next_binary(Information &, const char * & name, std::size_t & name_length);
+private:
+	DatabaseReader(const DatabaseReader &);
+	DatabaseReader & operator = (const DatabaseReader &);
+};
+
+DatabaseReader::DatabaseReader(
+	const std::string & name,
+	Source source
+) :
+	data(0),
+	length(0),
+	offset(0),
+	failed(true),
+	mapped(false),
+	is_binary(false),
+	is_corrupt(false),
+	algorithm(CUBEHASH)
+{
+	if (FILE_NAME == source ? !map_file(name) : log_database.enabled() ? !log_database.find(name, buffer) : !map_file(".redo/" + name + ".prereqs"))
+		return;
+	if (!mapped) {
+		data = buffer.empty() ? 0 : &buffer.front();
+		length = buffer.size();
+	}
+	failed = false;
+	if (length >= sizeof(DatabaseHeader) && 0 == std::memcmp(data, database_magic, sizeof database_magic)) {
+		const DatabaseHeader & h(*reinterpret_cast<const DatabaseHeader *>(data));
+		if (DATABASE_BYTE_ORDER != h.byte_order || DATABASE_VERSION != h.version) {
+			failed = true;
+			return;
+		}
+		is_binary = true;
+		algorithm = h.hash_algorithm < UNKNOWN_HASH_ALGORITHM ? static_cast<HashAlgorithm>(h.hash_algorithm) : UNKNOWN_HASH_ALGORITHM;
+		offset = sizeof h;
+	}
+}
+
+/// Map the file into memory, or failing that read it into the buffer.
+bool
+DatabaseReader::map_file(
+	const std::string & name
+) {
+#if defined(__OS2__) || defined(__WIN32__) || defined(__NT__)
+	std::ifstream f(name.c_str(), std::ios::binary);
+	if (f.fail()) return false;
+	buffer.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+#else
+	const int fd(open(name.c_str(), O_RDONLY|O_NOCTTY));
+	if (0 > fd) return false;
+	struct stat stbuf;
+	if (0 <= fstat(fd, &stbuf) && 0 < stbuf.st_size) {
+		void * p(mmap(0, static_cast<std::size_t>(stbuf.st_size), PROT_READ, MAP_PRIVATE, fd, 0));
+		if (MAP_FAILED != p) {
+			data = static_cast<const char *>(p);
+			length = static_cast<std::size_t>(stbuf.st_size);
+			mapped = true;
+		}
+	}
+	if (!mapped) {
+		std::size_t size(0);
+		for (;;) {
+			if (buffer.size() < size + 4096U)
+				buffer.resize(size + 4096U);
+			const ssize_t n(read(fd, &buffer[size], buffer.size() - size));
+			if (0 >= n) break;
+			size += static_cast<std::size_t>(n);
+		}
+		buffer.resize(size);
+	}
+	close(fd);
+#endif
+	return true;
+}
+
+DatabaseReader::~DatabaseReader()
+{
+#if !defined(__OS2__) && !defined(__WIN32__) && !defined(__NT__)
+	if (mapped)
+		munmap(const_cast<char *>(data), length);
+#endif
+}
+
+bool
+DatabaseReader::next_binary(
+	Information & i,
+	const char * & name,
+	std::size_t & name_length
+) {
+	if (offset + sizeof(DatabaseRecordHeader) > length) {
+		if (offset != length) is_corrupt = true;
+		return false;
+	}
+	const DatabaseRecordHeader & r(*reinterpret_cast<const DatabaseRecordHeader *>(data + offset));
+	const std::size_t record_length(sizeof r + r.hash_length + r.name_length);
+	if (length - offset < record_length || (0U != r.hash_length && sizeof i.hash != r.hash_length)) {
+		is_corrupt = true;
+		return false;
+	}
+	switch (r.type) {
+		case 'a':	i.type = i.NOTHING; break;
+		case 'n':	i.type = i.NO_DO_FILE; break;
+		case 's':	i.type = i.SPECIAL; break;
+		case 'd':	i.type = i.DIRECTORY; break;
+		case 'f':	i.type = i.FILE; break;
+		default:
+			is_corrupt = true;
+			return false;
+	}
+	i.hash_algorithm = algorithm;
+	i.last_written = static_cast<std::time_t>(r.last_written);
+	i.last_written_nsec = static_cast<long>(r.last_written_nsec);
+	i.size = r.size;
+	i.inode = r.inode;
+	i.has_fingerprint = 0U != (r.flags & DATABASE_HAS_FINGERPRINT);
+	const char * p(data + offset + sizeof r);
+	if (r.hash_length)
+		std::memcpy(i.hash, p, sizeof i.hash);
+	else
+		clear_hash(i);
+	name = p + r.hash_length;
+	name_length = r.name_length;
+	offset += database_padded(record_length);
+	return true;
+}
+
+/// Obtain the next record, returning false at the end of the database.
+/// The name remains valid for as long as the reader does.
+bool
+DatabaseReader::next(
+	Information & i,
+	const char * & name,
+	std::size_t & name_length
+) {
+	if (failed || is_corrupt) return false;
+	if (is_binary) return next_binary(i, name, name_length);
+	const char * const end(data + length);
+	while (offset < length) {
+		const char * p(data + offset);
+		const bool record(parse_db_line(p, end, algorithm, i, name, name_length));
+		offset = static_cast<std::size_t>(p - data);
+		if (record) return true;
+	}
+	return false;
+}
+
+bool
+DatabaseReader::next(
+	Information & i,
+	std::string & name
+) {
+	const char * n;
+	std::size_t l;
+	if (!next(i, n, l)) return false;
+	name.assign(n, l);
+	return true;
+}
+
+/* The GNU make jobserver ***************************************************
+// **************************************************************************
+*/
+
+static unsigned implicit_jobs = 1;
+static bool parse_fds(const char * prog, const char * s, int fds[], std::size_t max);
+static bool load_throttled(false);	///< whether the last attempt to procure a job slot was refused because of the load average
+
+// GNU make 4.4 and later provides its jobserver as a named FIFO, given in MAKEFLAGS as --jobserver-auth=fifo:PATH, rather than as a pair of inherited file descriptors.
+// Clients open it by name, and use the one descriptor for both taking and giving back job slots.
+// Because other clients can take a slot between a poll and a read, the descriptor is non-blocking, and a read that finds no slot is not an error.
+// redo does the same when asked to be such a jobserver, so that GNU make 4.4 run by .do scripts shares its job slots.
+// Older GNU make cannot parse the FIFO form, so it is not the default.
+
+static
+void
+remove_jobserver_fifo()
+{
+	if (jobserver_fifo_to_remove && getpid() == jobserver_fifo_owner)
+		unlink(jobserver_fifo_to_remove);
+}
+
+extern "C"
+void
+remove_jobserver_fifo_and_die (
+	int signo
+) {
+	remove_jobserver_fifo();
+	std::signal(signo, SIG_DFL);
+	std::raise(signo);
+}
+
+/// Use a jobserver named by a GNU make --jobserver-auth option, either a FIFO or a pair of file descriptor numbers.
+static
+bool
+open_jobserver (
+	const char * prog,
+	const std::string & auth
+) {
+	if (0 != auth.compare(0, 5, "fifo:"))
+		return parse_fds(prog, auth.c_str(), jobserver_fds, sizeof jobserver_fds/sizeof *jobserver_fds);
+	const std::string name(auth.substr(5));
+#if defined(__OS2__) || defined(__WIN32__) || defined(__NT__)
+	const int fd(open(name.c_str(), O_RDWR));
+#else
+	const int fd(open(name.c_str(), O_RDWR|O_NOCTTY|O_CLOEXEC|O_NONBLOCK));
+#endif
+	if (0 > fd) {
+		const int error(errno);
+		msg(prog, "ERROR") << name << ": " << std::strerror(error) << "\n";
+		return false;
+	}
+	jobserver_fds[0] = jobserver_fds[1] = fd;
+	jobserver_fifo = name;
+	return true;
+}
+
+/// Become the jobserver, with a named FIFO if asked for and possible, falling back to a pipe.
+static
+bool
+create_jobserver (
+	const char * prog,
+	bool named
+) {
+#if !defined(__OS2__) && !defined(__WIN32__) && !defined(__NT__)
+	if (named) {
+		const char * tmpdir(std::getenv("TMPDIR"));
+		std::ostringstream s;
+		s << (tmpdir && *tmpdir ? tmpdir : "/tmp") << "/redoFIFO" << getpid();
+		const std::string name(s.str());
+		if (0 <= mkfifo(name.c_str(), 0600)) {
+			const int fd(open(name.c_str(), O_RDWR|O_NOCTTY|O_CLOEXEC|O_NONBLOCK));
+			if (0 <= fd) {
+				jobserver_fds[0] = jobserver_fds[1] = fd;
+				jobserver_fifo = name;
+				jobserver_fifo_to_remove = strdup(name.c_str());
+				jobserver_fifo_owner = getpid();
+				std::atexit(remove_jobserver_fifo);
+				static const int signals[] = { SIGINT, SIGTERM, SIGHUP };
+				for (std::size_t j(0); j < sizeof signals/sizeof *signals; ++j) {
+					struct sigaction sa, old;
+					std::memset(&sa, 0, sizeof sa);
+					sa.sa_handler = remove_jobserver_fifo_and_die;
+					sigemptyset(&sa.sa_mask);
+					// A signal that was being ignored, as under nohup, stays ignored.
+					if (0 <= sigaction(signals[j], &sa, &old) && SIG_IGN == old.sa_handler)
+						sigaction(signals[j], &old, 0);
+				}
+				return true;
+			}
+			unlink(name.c_str());
+		}
+		const int error(errno);
+		if (verbose)
+			msg(prog, "INFO") << name << ": " << std::strerror(error) << ": Using a pipe for the jobserver instead.\n";
+	}
+#else
+	static_cast<void>(named);
+#endif
+	if (0 > pipe(jobserver_fds)) {
+		const int error(errno);
+		msg(prog, "ERROR") << "pipe: " << std::strerror(error) << "\n";
+		return false;
+	}
+	return true;
+}
+
+/// Whether the load average has reached the limit, in which case no more job slots are taken, even if there are some free, as with make -l.
+static inline
+bool
+load_too_high(
+	const char * prog
+) {
+	load_throttled = false;
+	if (max_load_average <= 0.0) return false;
+#if !defined(__OS2__) && !defined(__WIN32__) && !defined(__NT__)
+	double load[1];
+	if (1 > getloadavg(load, 1) || load[0] < max_load_average) return false;
+	if (debug) {
+		msg(prog, "INFO") << "Load average " << load[0] << " is too high to start another job.\n";
+	}
+	load_throttled = true;
+	return true;
+#else
+	static_cast<void>(prog);
+	return false;
+#endif
+}
+
+/// The number of jobs that the processors available to this process can run at once, going by its processor affinity and any cgroup v2 processor quota.
+static inline
+unsigned long
+available_processors()
+{
+	unsigned long n(1UL);
+#if defined(__linux__)
+	cpu_set_t set;
+	if (0 == sched_getaffinity(0, sizeof set, &set))
+		n = static_cast<unsigned long>(CPU_COUNT(&set));
+	std::string group;
+	std::ifstream cgroup("/proc/self/cgroup");
+	for (std::string line; std::getline(cgroup, line); )
+		if (0 == line.compare(0, 3, "0::"))
+			group = line.substr(3);
+	// Every cgroup from this one up to the root can impose a quota.
+	while (!group.empty()) {
+		std::ifstream cpu_max(("/sys/fs/cgroup" + group + "/cpu.max").c_str());
+		std::string quota;
+		unsigned long period(0UL);
+		if ((cpu_max >> quota >> period) && "max" != quota && period) {
+			const unsigned long limit((std::strtoul(quota.c_str(), 0, 10) + period - 1UL) / period);
+			if (limit && limit < n) n = limit;
+		}
+		const std::string::size_type slash(group.rfind('/'));
+		group.erase(std::string::npos == slash ? 0 : slash);
+	}
+#elif defined(_SC_NPROCESSORS_ONLN)
+	const long online(sysconf(_SC_NPROCESSORS_ONLN));
+	if (0 < online) n = static_cast<unsigned long>(online);
+#endif
+	return n ? n : 1UL;
+}
+
+static inline
+bool
+try_procure_job_slot(
+	const char * prog
+) {
+	if (implicit_jobs) {
+		--implicit_jobs;
+		if (debug) {
+			msg(prog, "INFO") << "Re-using implicit job slot that is this process itself.\n";
+		}
+		return true;
+	}
+	if (load_too_high(prog)) return false;
+	if (-1 != jobserver_fds[0]) {
+		pollfd p;
+		p.fd = jobserver_fds[0];
+		p.events = POLLIN;
+		const int r0(poll(&p, sizeof p/sizeof(pollfd), 0));
+		if ((0 <= r0) && (p.revents & POLLIN)) {
+			char c;
+			const int r(read(jobserver_fds[0], &c, sizeof c));
+			if (debug) {
+				if (0 < r)
+					msg(prog, "INFO") << "Procured a job slot from the jobserver.\n";
+				else
+					msg(prog, "INFO") << "Failed to procure a job slot from the jobserver.\n";
+			}
+			return 0 < r;
+		}
+	}
+	return false;
+}
+
+static inline
+bool
+procure_job_slot(
+	const char * prog
+) {
+	if (implicit_jobs) {
+		--implicit_jobs;
+		if (debug) {
+			msg(prog, "INFO") << "Re-using implicit job slot that is this process itself.\n";
+		}
+		return true;
+	}
+	if (-1 != jobserver_fds[0]) {
+		char c;
+		int r(read(jobserver_fds[0], &c, sizeof c));
+		// A non-blocking FIFO jobserver is waited upon until a slot is actually obtained.
+		while (0 > r && (EAGAIN == errno || EWOULDBLOCK == errno)) {
+			pollfd p;
+			p.fd = jobserver_fds[0];
+			p.events = POLLIN;
+			poll(&p, sizeof p/sizeof(pollfd), -1);
+			r = read(jobserver_fds[0], &c, sizeof c);
+		}
+		if (debug) {
+			if (0 < r)
+				msg(prog, "INFO") << "Procured a job slot from the jobserver.\n";
+			else
+				msg(prog, "INFO") << "Failed to procure a job slot from the jobserver.\n";
+		}
+		return 0 < r;
+	}
+	return false;
+}
+
+static inline
+void
+vacate_job_slot(
+	const char * prog
+) {
+	if (-1 != jobserver_fds[1]) {
+		const char c('\0');
+		write(jobserver_fds[1], &c, sizeof c);
+		if (debug) {
+			msg(prog, "INFO") << "Vacated a job slot to the jobserver.\n";
+		}
+	} else
+		++implicit_jobs;
+}
+
+/* Redo internals ***********************************************************
+// **************************************************************************
+*/
+
+static inline
+bool
+record_prerequisites (
+	const char * prog,
+	const std::vector<const char *> & filev
+) {
+	if (-1 == redoparent_fd) {
+		msg(prog, "ERROR") << "Not invoked within a .do script.\n";
+		return false;
+	}
+	if (debug) {
+		msg(prog, "INFO") << "RECORD-PREREQUISITES: >";
+		for ( std::vector<const char *>::const_iterator i = filev.begin(); i != filev.end(); ++i ) {
+			const char * arg(*i);
+			std::clog << ' ' << arg;
+		}
+		std::clog << '<' << std::endl;
+	}
+
+	FileInfoRequests requests;
+	for ( std::vector<const char *>::const_iterator i = filev.begin(); i != filev.end(); ++i )
+		requests.push_back(FileInfoRequest(paths.intern(*i), 0));
+	batch_file_info(requests);
+
+	std::string s;
+	for ( FileInfoRequests::const_iterator r = requests.begin(); r != requests.end(); ++r ) {
+		const Information & info(get_file_info(r->name, 0));
+		put_db_record(s, info, paths.name(r->name));
+	}
+	if (0 > write(redoparent_fd, s.data(), s.length())) {
+		int error = errno;
+		msg(prog, "ERROR") << std::strerror(error) << "\n";
+		return false;
+	}
+
+	return true;
+}
+
+static inline bool redo (bool, const char * prog, unsigned meta_depth, const std::vector<const char *> & filev);
+
+static
+bool
+redo_ifcreate (
+	const char * prog,
+	const std::vector<const char *> & filev
+) {
+	bool status(true);
+	for ( std::vector<const char *>::const_iterator i = filev.begin(); i != filev.end(); ++i ) {
+		const char * arg(*i);
+		if (0 <= access(arg, F_OK)) {
+			msg(prog, "ERROR") << arg << ": File/directory exists.\n";
+			status = false;
+			continue;
+		}
+	}
+	if (!status) return status;
+
+	return record_prerequisites (prog, filev);
+}
+
+static inline
+bool
+redo_ifcreate_1 (
+	const char * prog,
+	const char * file
+) {
+	std::vector<const char *> filev;
+	filev.push_back(file);
+	return redo_ifcreate(prog, filev);
+}
+
+static inline
+bool
+redo_ifchange (
+	const char * prog,
+	unsigned meta_depth,
+	const std::vector<const char *> & filev
+) {
+	return redo(false, prog, meta_depth, filev) && record_prerequisites(prog, filev);
+}
+
+static inline
+bool
+redo_ifchange_1 (
+	const char * prog,
+	unsigned meta_depth,
+	const char * file
+) {
+	std::vector<const char *> filev;
+	filev.push_back(file);
+	return redo_ifchange(prog, meta_depth, filev);
+}
+
+/* Searching for .do files *************************************************
+// **************************************************************************
+*/
+
+// Rather than testing for each candidate .do file name in turn, each directory is read once per process, and the candidates looked up in a listing of the .do files in it.
+// A directory that has none of the candidates for a name is recorded in the database with a single "no .do file for N in D" record, rather than with one non-existence record per candidate.
+
+typedef std::set<std::string> DirectoryListing;
+typedef std::map<std::string, DirectoryListing> DirectoryListings;
+static DirectoryListings directory_listings;
+
+static inline
+bool
+is_do_file_name (
+	const char * name,
+	std::size_t len
+) {
+	return len >= 3 && 0 == std::memcmp(name + len - 3, ".do", 3);
+}
+
+#if !defined(__OS2__) && !defined(__WIN32__) && !defined(__NT__)
+// The listings are also kept across processes, in .redo/do-index, keyed by the device, i-node, and modification time of each directory.
+// Then a later process need only stat() a directory instead of reading it.
+// Like the hash cache, this is one of the append-only record files in .redo.
+class DoFileIndex {
+public:
+	DoFileIndex() : file(".redo/do-index"), loaded(false) {}
+	bool lookup(const struct stat &, DirectoryListing &);
+	void store(const struct stat &, const DirectoryListing &);
+protected:
+	enum { MAGIC = 0x78646f44U, MIN_COMPACTION_RECORDS = 1024U };
+	struct Record {
+		uint32_t magic;
+		uint32_t check;
+		uint64_t dev, ino;
+		int64_t mtime_sec;
+		uint32_t mtime_nsec;
+		uint32_t names_length;	///< the length of the names that follow, each terminated by a NUL, before padding
+	};
+	struct Entry {
+		int64_t mtime_sec;
+		uint32_t mtime_nsec;
+		DirectoryListing names;
+	};
+	typedef std::pair<uint64_t, uint64_t> Key;
+	typedef std::map<Key, Entry> EntryMap;
+	RecordFile file;
+	bool loaded;
+	EntryMap entries;
+
+	static void make_record(std::string &, const Key &, const Entry &);
+	void load();
+	void compact();
+};
+
+void
+DoFileIndex::make_record(
+	std::string & s,
+	const Key & k,
+	const Entry & e
+) {
+	std::string names;
+	for (DirectoryListing::const_iterator n(e.names.begin()); n != e.names.end(); ++n) {
+		names += *n;
+		names += '\0';
+	}
+	Record r;
+	std::memset(&r, 0, sizeof r);
+	r.magic = MAGIC;
+	r.dev = k.first;
+	r.ino = k.second;
+	r.mtime_sec = e.mtime_sec;
+	r.mtime_nsec = e.mtime_nsec;
+	r.names_length = static_cast<uint32_t>(names.length());
+	const std::size_t start(s.length());
+	s.append(reinterpret_cast<const char *>(&r), sizeof r);
+	s += names;
+	RecordFile::seal(s, start, offsetof(Record, check));
+}
+
+void
+DoFileIndex::load()
+{
+	loaded = true;
+	if (!file.open()) return;
+	std::vector<unsigned char> buf;
+	file.read(buf);
+	const std::size_t length(buf.size());
+	std::size_t total(0), invalid(0);
+	for (std::size_t off(0); off + sizeof(Record) <= length; ) {
+		Record r;
+		std::memcpy(&r, &buf[off], sizeof r);
+		const std::size_t size(database_padded(sizeof r + r.names_length));
+		if (MAGIC != r.magic || size > length - off || !RecordFile::intact(&buf[off], size, offsetof(Record, check))) {
+			off += DATABASE_ALIGNMENT;
+			invalid += DATABASE_ALIGNMENT;
+			continue;
+		}
+		Entry & e(entries[Key(r.dev, r.ino)]);
+		e.mtime_sec = r.mtime_sec;
+		e.mtime_nsec = r.mtime_nsec;
+		e.names.clear();
+		const char * p(reinterpret_cast<const char *>(&buf[off + sizeof r]));
+		const char * const end(p + r.names_length);
+		while (p < end) {
+			const std::size_t n(strnlen(p, static_cast<std::size_t>(end - p)));
+			e.names.insert(std::string(p, n));
+			p += n + 1;
+		}
+		off += size;
+		++total;
+	}
+	if ((total >= MIN_COMPACTION_RECORDS && total > 2U * entries.size()) || invalid >= MIN_COMPACTION_RECORDS * sizeof(Record))
+		compact();
+}
+
+void
+DoFileIndex::compact()
+{
+	std::string all;
+	for (EntryMap::const_iterator i(entries.begin()); i != entries.end(); ++i)
+		make_record(all, i->first, i->second);
+	file.rewrite(all);
+}
+
+bool
+DoFileIndex::lookup(
+	const struct stat & s,
+	DirectoryListing & names
+) {
+	if (!loaded) load();
+	EntryMap::const_iterator i(entries.find(Key(s.st_dev, s.st_ino)));
+	if (entries.end() == i
+	||  i->second.mtime_sec != static_cast<int64_t>(s.st_mtime)
+	||  i->second.mtime_nsec != static_cast<uint32_t>(mtime_nsec(s))
+	)
+		return false;
+	names = i->second.names;
+	return true;
+}
+
+void
+DoFileIndex::store(
+	const struct stat & s,
+	const DirectoryListing & names
+) {
+	if (!loaded) load();
+	if (!file.is_open()) return;
+	// A directory modified within the last couple of seconds could be modified again without its timestamp changing, on filesystems with coarse timestamps.
+	const std::time_t now(std::time(0));
+	if (s.st_mtime + 2 > now) return;
+	const Key k(s.st_dev, s.st_ino);
+	Entry & e(entries[k]);
+	e.mtime_sec = static_cast<int64_t>(s.st_mtime);
+	e.mtime_nsec = static_cast<uint32_t>(mtime_nsec(s));
+	e.names = names;
+	std::string r;
+	make_record(r, k, e);
+	file.append(r.data(), r.length());
+}
+
+static DoFileIndex do_file_index;
+#endif
+
+/// The .do files in a directory named with its trailing slash, or the empty string for the current directory; or 0 if it cannot be read.
+static
+const DirectoryListing *
+get_directory_listing (
+	const std::string & dir
+) {
+	DirectoryListings::iterator l(directory_listings.find(dir));
+	if (directory_listings.end() != l) return &l->second;
+	const char * dir_name(dir.empty() ? "." : dir.c_str());
+#if !defined(__OS2__) && !defined(__WIN32__) && !defined(__NT__)
+	struct stat s;
+	if (0 > stat(dir_name, &s)) return 0;
+	DirectoryListing names;
+	if (do_file_index.lookup(s, names)) {
+		DirectoryListing & listing(directory_listings[dir]);
+		listing.swap(names);
+		return &listing;
+	}
+#endif
+	DIR * d(opendir(dir_name));
+	if (!d) return 0;
+	DirectoryListing & listing(directory_listings[dir]);
+	while (const struct dirent * e = readdir(d))
+		if (is_do_file_name(e->d_name, std::strlen(e->d_name)))
+			listing.insert(e->d_name);
+	closedir(d);
+#if !defined(__OS2__) && !defined(__WIN32__) && !defined(__NT__)
+	do_file_index.store(s, listing);
+#endif
+	return &listing;
+}
+
+/// Forget a directory listing, because something in the directory has been created or renamed.
+static inline
+void
+invalidate_directory_listing (
+	const std::string & name
+) {
+	const char * b(basename_of(name.c_str()));
+	directory_listings.erase(std::string(name.c_str(), static_cast<std::size_t>(b - name.c_str())));
+}
+
+/// The candidate .do file names for the (base)name b, in search order, together with the base and extension that each implies.
+static inline
+void
+do_file_candidates (
+	const char * const b,
+	std::vector<std::string> & names,
+	std::vector<std::string> & bases,
+	std::vector<std::string> & exts
+) {
+	names.push_back(std::string(b) + ".do");
+	bases.push_back(b);
+	exts.push_back(std::string());
+	for (const char * e(extension(b)); ; e = extension(e + 1)) {
+		names.push_back("default" + std::string(e) + ".do");
+		bases.push_back(std::string(b, static_cast<std::size_t>(e - b)));
+		exts.push_back(e);
+		if (!*e) break;
+	}
+}
+
+/// Whether there is still no .do file for the name in its directory, as the database recorded.
+static inline
+bool
+still_no_do_file (
+	const std::string & name
+) {
+	const char * b(basename_of(name.c_str()));
+	const DirectoryListing * listing(get_directory_listing(std::string(name.c_str(), static_cast<std::size_t>(b - name.c_str()))));
+	if (!listing) return false;
+	std::vector<std::string> names, bases, exts;
+	do_file_candidates(b, names, bases, exts);
+	for (std::vector<std::string>::const_iterator n(names.begin()); n != names.end(); ++n)
+		if (listing->end() != listing->find(*n))
+			return false;
+	return true;
+}
+
+static inline
+bool
+record_no_do_file (
+	const char * prog,
+	const std::string & name
+) {
+	if (-1 == redoparent_fd) {
+		msg(prog, "ERROR") << "Not invoked within a .do script.\n";
+		return false;
+	}
+	Information i;
+	i.type = i.NO_DO_FILE;
+	i.hash_algorithm = hash_algorithm;
+	i.last_written = -1;
+	i.last_written_nsec = 0;
+	i.size = i.inode = 0U;
+	i.has_fingerprint = false;
+	clear_hash(i);
+	std::string s;
+	put_db_record(s, i, name.c_str());
+	if (0 > write(redoparent_fd, s.data(), s.length())) {
+		const int error(errno);
+		msg(prog, "ERROR") << std::strerror(error) << "\n";
+		return false;
+	}
+	return true;
+}
+
+static inline
+bool
+find_do_file (
+	const char * prog,
+	unsigned meta_depth,
+	const char * const arg,
+	const char * const b,
+	std::string & dofile_name,
+	std::string & base,
+	std::string & ext
+) {
+	std::vector<std::string> names, bases, exts;
+	do_file_candidates(b, names, bases, exts);
+	std::string dir(arg, static_cast<std::size_t>(b - arg));
+	for (;;) {
+		const DirectoryListing * listing(get_directory_listing(dir));
+		std::size_t j(0);
+		while (j < names.size() && (!listing || listing->end() == listing->find(names[j])))
+			++j;
+		if (j < names.size()) {
+			// In the directory where the search ends, the candidates that preceded the one found are recorded individually.
+			for (std::size_t k(0); k < j; ++k)
+				redo_ifcreate_1(prog, (dir + names[k]).c_str());
+			dofile_name = dir + names[j];
+			base = bases[j];
+			ext = exts[j];
+			redo_ifchange_1(prog, meta_depth + 1, dofile_name.c_str());
+			return true;
+		}
+		// A directory that could not be listed could not be checked as a whole later, which would make the target out of date for ever, so its candidates are recorded individually.
+		if (listing)
+			record_no_do_file(prog, dir + b);
+		else
+			for (std::size_t k(0); k < names.size(); ++k)
+				redo_ifcreate_1(prog, (dir + names[k]).c_str());
+
+		std::string::size_type len(dir.length());
+		if (len < 2) return false;
+		std::string::size_type slash(dir.find_last_of('/', len - 2));
+#if defined(__OS2__) || defined(__WIN32__) || defined(__NT__)
+		if (std::string::npos == slash)
+			slash = dir.find_last_of('\\', len - 2);
+#endif
+		if (std::string::npos == slash)
+			dir = std::string();
+		else
+			dir = dir.substr(0, slash + 1);
+	}
+}
+
+/* Job metrics **************************************************************
+// **************************************************************************
+*/
+
+// How long the .do script for each target took to run, and what resources it used, the last time that it succeeded, is kept in .redo/metrics, for the scheduler to estimate from.
+// It is not kept in the target's database, which is what the .do script records, and which is committed before the script's running time is known to its parent.
+// Like the other caches in .redo, it is an append-only record file, to which every process appends, with the last record for a target winning.
+
+#if !defined(__OS2__) && !defined(__WIN32__) && !defined(__NT__)
+class JobMetrics {
+public:
+	struct Entry {
+		Entry() : wall_seconds(0.0), user_seconds(0.0), system_seconds(0.0), max_rss_kib(0), input_blocks(0), output_blocks(0) {}
+		double wall_seconds, user_seconds, system_seconds;
+		uint64_t max_rss_kib;	///< the peak resident set size of the script and whichever of its descendants it waited for
+		uint64_t input_blocks, output_blocks;
+	};
+	JobMetrics() : file(".redo/metrics"), loaded(false) {}
+	const Entry * find(const std::string &);
+	void store(const std::string &, const Entry &);
+protected:
+	enum { MAGIC = 0x326d6472U, MIN_COMPACTION_RECORDS = 1024U };
+	struct Record {
+		uint32_t magic;
+		uint32_t check;
+		uint64_t wall_microseconds, user_microseconds, system_microseconds;
+		uint64_t max_rss_kib;
+		uint64_t input_blocks, output_blocks;
+		uint32_t name_length;	///< the length of the name that follows, before padding
+		uint32_t reserved;
+	};
+	typedef std::map<std::string, Entry> EntryMap;
+	RecordFile file;
+	bool loaded;
+	EntryMap entries;
+
+	static void make_record(std::string &, const std::string &, const Entry &);
+	void load();
+	void compact();
+};
+
+void
+JobMetrics::make_record(
+	std::string & s,
+	const std::string & name,
+	const Entry & e
+) {
+	Record r;
+	std::memset(&r, 0, sizeof r);
+	r.magic = MAGIC;
+	r.wall_microseconds = static_cast<uint64_t>(e.wall_seconds * 1E6);
+	r.user_microseconds = static_cast<uint64_t>(e.user_seconds * 1E6);
+	r.system_microseconds = static_cast<uint64_t>(e.system_seconds * 1E6);
+	r.max_rss_kib = e.max_rss_kib;
+	r.input_blocks = e.input_blocks;
+	r.output_blocks = e.output_blocks;
+	r.name_length = static_cast<uint32_t>(name.length());
+	const std::size_t start(s.length());
+	s.append(reinterpret_cast<const char *>(&r), sizeof r);
+	s += name;
+	RecordFile::seal(s, start, offsetof(Record, check));
+}
+
+void
+JobMetrics::load()
+{
+	loaded = true;
+	if (!file.open()) return;
+	std::vector<unsigned char> buf;
+	file.read(buf);
+	const std::size_t length(buf.size());
+	std::size_t total(0), invalid(0);
+	for (std::size_t off(0); off + sizeof(Record) <= length; ) {
+		Record r;
+		std::memcpy(&r, &buf[off], sizeof r);
+		const std::size_t size(database_padded(sizeof r + r.name_length));
+		if (MAGIC != r.magic || size > length - off || !RecordFile::intact(&buf[off], size, offsetof(Record, check))) {
+			off += DATABASE_ALIGNMENT;
+			invalid += DATABASE_ALIGNMENT;
+			continue;
+		}
+		Entry & e(entries[std::string(reinterpret_cast<const char *>(&buf[off + sizeof r]), r.name_length)]);
+		e.wall_seconds = static_cast<double>(r.wall_microseconds) / 1E6;
+		e.user_seconds = static_cast<double>(r.user_microseconds) / 1E6;
+		e.system_seconds = static_cast<double>(r.system_microseconds) / 1E6;
+		e.max_rss_kib = r.max_rss_kib;
+		e.input_blocks = r.input_blocks;
+		e.output_blocks = r.output_blocks;
+		off += size;
+		++total;
+	}
+	if ((total >= MIN_COMPACTION_RECORDS && total > 2U * entries.size()) || invalid >= MIN_COMPACTION_RECORDS * sizeof(Record))
+		compact();
+}
+
+void
+JobMetrics::compact()
+{
+	std::string all;
+	for (EntryMap::const_iterator i(entries.begin()); i != entries.end(); ++i)
+		make_record(all, i->first, i->second);
+	file.rewrite(all);
+}
+
+const JobMetrics::Entry *
+JobMetrics::find(
+	const std::string & name
+) {
+	if (!loaded) load();
+	EntryMap::const_iterator i(entries.find(name));
+	return entries.end() == i ? 0 : &i->second;
+}
+
+void
+JobMetrics::store(
+	const std::string & name,
+	const Entry & e
+) {
+	if (!loaded) load();
+	if (!file.is_open()) return;
+	entries[name] = e;
+	std::string r;
+	make_record(r, name, e);
+	file.append(r.data(), r.length());
+}
+#else
+class JobMetrics {
+public:
+	struct Entry {
+		Entry() : wall_seconds(0.0), user_seconds(0.0), system_seconds(0.0), max_rss_kib(0), input_blocks(0), output_blocks(0) {}
+		double wall_seconds, user_seconds, system_seconds;
+		uint64_t max_rss_kib;	///< the peak resident set size of the script and whichever of its descendants it waited for
+		uint64_t input_blocks, output_blocks;
+	};
+	const Entry * find(const std::string &) { return 0; }
+	void store(const std::string &, const Entry &) {}
+};
+#endif
+
+static JobMetrics job_metrics;
+
+/* Jobs *********************************************************************
+// **************************************************************************
+*/
+
+class RedoParentFDStack {
+public:
+	RedoParentFDStack ( int new_fd ) : old_fd(redoparent_fd) { redoparent_fd = new_fd; }
+	~RedoParentFDStack() { redoparent_fd = old_fd; }
+protected:
+	int old_fd;
+};
+
+struct Job {
+	Job() : lock_fd(-1), pid(-1), busy(false), started(0.0) {}
+	int lock_fd, pid;
+	bool busy;	///< whether the lock could not be acquired because another process holds it
+	double started;
+#if !defined(__OS2__) && !defined(__WIN32__) && !defined(__NT__)
+	struct rusage usage;	///< as reported when the script was reaped
+#endif
+	PathID target;
+	const char * arg;	///< the name of the target
+	std::string tmp_target;
+	std::string script;
+	std::string database_name;
+	std::string tmp_database_name;
+	std::string lock_database_name;
+};
+
+/// Lock a target against being built by another process at the same time, optionally waiting for whatever other process is building it to finish.
+static inline
+bool
+acquire_job_lock (
+	const char * prog,
+	Job & job,
+	bool wait
+) {
+	job.lock_fd = -1;
+	job.busy = false;
+	if (log_database.enabled())
+		return log_database.lock(prog, job.arg, wait, job.busy);
+#if defined(__OS2__) || defined(__WIN32__) || defined(__NT__)
+	int lock_fd(open(job.lock_database_name.c_str(), O_WRONLY|O_TRUNC|O_CREAT, 0777));
+#else		
+	int lock_fd(open(job.lock_database_name.c_str(), O_WRONLY|O_TRUNC|O_CREAT|O_NOCTTY, 0777));
+#endif		
+	if (0 > lock_fd) {
+		const int error(errno);
+		msg(prog, "ERROR") << job.lock_database_name << ": " << std::strerror(error) << "\n";
+		return false;
+	}
+#if defined(__OS2__) || defined(__WIN32__) || defined(__NT__)
+#else
+	if (debug) {
+		msg(prog, "INFO") << job.lock_database_name << ": Locking ...\n";
+	}
+	struct flock flock;
+	flock.l_whence = SEEK_SET;
+	flock.l_start = 0;
+	flock.l_len = 0;
+	flock.l_type = F_WRLCK;
+	int f(fcntl(lock_fd, wait ? F_SETLKW : F_SETLK, &flock));
+	if (0 > f) {
+		const int error(errno);
+		if (!wait && (EAGAIN == error || EACCES == error))
+			job.busy = true;
+		else
+			msg(prog, "ERROR") << job.lock_database_name << ": " << std::strerror(error) << "\n";
+		close(lock_fd);
+		return false;
+	}
+#endif
+	job.lock_fd = lock_fd;
+	return true;
+}
+
+static inline
+void
+release_job_lock (
+	Job & job
+) {
+	if (log_database.enabled())
+		log_database.unlock(job.arg);
+	else
+		close(job.lock_fd);
+	job.lock_fd = -1;
+}
+
+static inline
+bool
+run (
+#if defined(__OS2__) || defined(__WIN32__) || defined(__NT__)
+	const char * comspec,
+#endif
+	const char * prog,
+	unsigned meta_depth,
+	Job & job
+) {
+	job.pid = -1;
+
+	const char * b(basename_of(job.arg));
+	if (b != job.arg && !log_database.enabled())
+		makepath(".redo/" + std::string(job.arg, static_cast<std::size_t>(b - 1 - job.arg)));
+
+	// Rather than sleeping whilst holding a job slot, the caller is told that the target is busy, so that it can wait for the other build to finish without one.
+	if (!acquire_job_lock(prog, job, false))
+		return false;
+#if defined(__OS2__) || defined(__WIN32__) || defined(__NT__)		
+	int db_fd(open(job.tmp_database_name.c_str(), O_WRONLY|O_TRUNC|O_CREAT, 0777));
 #else		
 	int db_fd(open(job.tmp_database_name.c_str(), O_WRONLY|O_TRUNC|O_CREAT|O_NOCTTY, 0777));
 #endif		
 	if (0 > db_fd) {
 		const int error(errno);
-		msg(prog, "ERROR") << job.tmp_database_name << ": " << std::strerror(error) << "\n";
-		close(lock_fd);
+		msg(prog, "ERROR") << job.tmp_database_name << ": " << std::strerror(error) << "\n";
+		release_job_lock(job);
+		return false;
+	}
+
+	{
+		std::string h;
+		put_db_header(h, hash_algorithm);
+		if (0 > write(db_fd, h.data(), h.length())) {
+			const int error(errno);
+			msg(prog, "ERROR") << job.tmp_database_name << ": " << std::strerror(error) << "\n";
+			close(db_fd);
+			release_job_lock(job);
+			return false;
+		}
+	}
+	// A target is known to be a target from when its first build starts.
+	if (log_database.enabled() && !log_database.known(job.arg) && !log_database.begin(prog, job.arg)) {
+		close(db_fd);
+		std::remove(job.tmp_database_name.c_str());
+		release_job_lock(job);
+		return false;
+	}
+	if (!log_database.enabled())
+		target_index.add(job.target);
+
+	RedoParentFDStack saved_parent(db_fd);
+	std::string dofile_name, dir(job.arg, static_cast<std::size_t>(b - job.arg)), base, ext;
+	if (!find_do_file(prog, meta_depth, job.arg, b, dofile_name, base, ext)) {
+		msg(prog, "ERROR") << job.arg << ": Cannot find .do file to use.\n";
+		close(db_fd);
+		if (log_database.enabled()) std::remove(job.tmp_database_name.c_str());
+		release_job_lock(job);
+		return false;
+	}
+	const std::string fullbase(dir + base);
+	std::remove(job.tmp_target.c_str());
+#if defined(__OS2__) || defined(__WIN32__) || defined(__NT__)
+	if (ext.empty()) ext = ".";	// There is a bug in the Interix sh.bat that causes it to lose empty arguments.
+#endif
+
+	job.script = dofile_name;
+
+#if !defined(__OS2__) && !defined(__WIN32__) && !defined(__NT__)
+	const char * comspec(job.script.c_str());
+#endif
+	const char * argv[9] = {
+#if defined(__OS2__) || defined(__WIN32__) || defined(__NT__)
+		comspec,
+		"/c",
+		"sh",
+		"-e",
+#endif
+		dofile_name.c_str(),
+		fullbase.c_str(),
+		ext.c_str(),
+		job.tmp_target.c_str(),
+		NULL
+	};
+	std::vector<const char *> envv;
+	for (char **e(environ); *e; ++e)
+		envv.push_back(*e);
+	std::ostringstream redoflags;
+	redoflags << "REDOFLAGS=";
+	if (keep_going) redoflags << " --keep-going";
+	if (debug) redoflags << " --debug";
+	if (silent) redoflags << " --silent";
+	if (verbose) redoflags << " --verbose";
+	if (CUBEHASH != hash_algorithm) redoflags << " --hash-algorithm=" << hash_algorithm_names[hash_algorithm];
+	if (-1 != db_fd) redoflags << " --redoparent-fd=" << db_fd;
+	if (-1 != file_info_server_fd) redoflags << " --file-info-server-fd=" << file_info_server_fd;
+	if (max_memory_mib) redoflags << " --max-memory " << max_memory_mib;
+	if (max_load_average > 0.0) redoflags << " --load-average " << max_load_average;
+	if (!jobserver_fifo.empty())
+		redoflags << " --jobserver-auth=fifo:" << jobserver_fifo;
+	else
+	if (-1 != jobserver_fds[0]) {
+		redoflags << " --jobserver-fds=" << jobserver_fds[0];
+		if (-1 != jobserver_fds[1])
+			redoflags << "," << jobserver_fds[1];
+	}
+	const std::string redoflags_str(redoflags.str());
+	envv.push_back(redoflags_str.c_str());
+	envv.push_back(0);
+
+	if (verbose)
+		msg(prog, "INFO") << "spawn: " << dofile_name << " " << fullbase << " " << ext << " " << job.tmp_target << "\n" << std::flush;
+	job.started = monotonic_seconds();
+#if !defined(__OS2__) && !defined(__WIN32__) && !defined(__NT__)
+	// Of all of the programs that redo runs, only .do scripts inherit the file information server socket.
+	if (-1 != file_info_server_fd) set_close_on_exec(file_info_server_fd, false);
+#endif
+	job.pid = spawnve(P_NOWAIT, comspec, argv, const_cast<const char **>(&envv.front()));
+#if !defined(__OS2__) && !defined(__WIN32__) && !defined(__NT__)
+	if (-1 != file_info_server_fd) set_close_on_exec(file_info_server_fd, true);
+#endif
+	close(db_fd);
+
+	return true;
+}
+
+/// Reduce the database built up by the .do script to one record per name, the last recorded, in name order.
+/// Scripts that run redo-ifchange in loops, and the .do file search, otherwise leave many duplicate records for every later check to repeat.
+static inline
+bool
+canonicalize_database (
+	const char * prog,
+	const Job & job,
+	std::string & database
+) {
+	DatabaseReader build(job.tmp_database_name, DatabaseReader::FILE_NAME);
+	if (build.fail()) return false;
+	// A record that no .do file exists for a name is about a different thing to a record about that name itself.
+	typedef std::map<std::pair<std::string, bool>, Information> Records;
+	Records records;
+	std::size_t count(0);
+	Information i;
+	const char * name;
+	std::size_t name_length;
+	while (build.next(i, name, name_length)) {
+		records[Records::key_type(std::string(name, name_length), i.NO_DO_FILE == i.type)] = i;
+		++count;
+	}
+	if (build.corrupt()) return false;
+	put_db_header(database, build.hash_algorithm());
+	for (Records::const_iterator r(records.begin()); r != records.end(); ++r)
+		put_db_record(database, r->second, r->first.first.c_str());
+	if (debug)
+		msg(prog, "INFO") << job.arg << ": Reduced " << count << " database records to " << records.size() << ".\n";
+	return true;
+}
+
+/// Put the newly built database in place, atomically.
+static inline
+bool
+commit_database (
+	const char * prog,
+	Job & job
+) {
+	std::string database;
+	const bool canonical(canonicalize_database(prog, job, database));
+	if (log_database.enabled()) {
+		if (!canonical) {
+			std::ifstream f(job.tmp_database_name.c_str(), std::ios::binary);
+			database.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+		}
+		const bool ok(log_database.commit(prog, job.arg, database));
+		std::remove(job.tmp_database_name.c_str());
+		return ok;
+	}
+	if (canonical) {
+		std::ofstream f(job.tmp_database_name.c_str(), std::ios::binary|std::ios::trunc);
+		f.write(database.data(), static_cast<std::streamsize>(database.length()));
+		f.close();
+		if (f.fail()) {
+			const int error(errno);
+			msg(prog, "ERROR") << job.tmp_database_name << ": Unable to write database file: " << std::strerror(error) << "\n";
+			return false;
+		}
+	}
+	if (0 > posix_rename(job.tmp_database_name.c_str(), job.database_name.c_str())) {
+		const int error(errno);
+		msg(prog, "ERROR") << job.tmp_database_name << ": Unable to rename database file: " << std::strerror(error) << "\n";
+		return false;
+	}
+	return true;
+}
+
+static inline
+bool
+finish (
+	const char * prog,
+	Job & job,
+	int exit_status
+) {
+	job.pid = -1;
+	if (!WIFEXITED(exit_status) || (0 < WEXITSTATUS(exit_status))) {
+		msg(prog, "ERROR") << job.arg << ": Not done.\n";
+		rmrf(job.tmp_target.c_str());
+		if (log_database.enabled()) std::remove(job.tmp_database_name.c_str());
+		release_job_lock(job);
+		return false;
+	}
+	struct stat stbuf;
+	if (0 > posix_lstat(job.tmp_target.c_str(), &stbuf)) {
+		std::ofstream tmp(job.tmp_target.c_str(), std::ios::app);
+	}
+	if ((0 <= posix_lstat(job.arg, &stbuf)) && S_ISDIR(stbuf.st_mode)) {
+		if (0 > rmrf(job.arg)) {
+			const int error(errno);
+			msg(prog, "ERROR") << job.arg << ": Unable to remove contents of target directory: " << std::strerror(error) << "\n";
+			rmrf(job.tmp_target.c_str());
+			release_job_lock(job);
+			return false;
+		}
+	}
+	delete_file_info(job.target);
+	invalidate_directory_listing(job.arg);
+	if (!commit_database(prog, job)) {
+		rmrf(job.tmp_target.c_str());
+		release_job_lock(job);
+		return false;
+	}
+	if (0 > posix_rename(job.tmp_target.c_str(), job.arg)) {
+		const int error(errno);
+		msg(prog, "ERROR") << job.arg << ": Unable to rename target file: " << std::strerror(error) << "\n";
+		rmrf(job.tmp_target.c_str());
+		release_job_lock(job);
 		return false;
 	}
+	forget_served_file_info(job.target);
+	JobMetrics::Entry metrics;
+	metrics.wall_seconds = monotonic_seconds() - job.started;
+#if !defined(__OS2__) && !defined(__WIN32__) && !defined(__NT__)
+	metrics.user_seconds = static_cast<double>(job.usage.ru_utime.tv_sec) + static_cast<double>(job.usage.ru_utime.tv_usec) / 1E6;
+	metrics.system_seconds = static_cast<double>(job.usage.ru_stime.tv_sec) + static_cast<double>(job.usage.ru_stime.tv_usec) / 1E6;
+#if defined(__APPLE__) && defined(__MACH__)
+	metrics.max_rss_kib = static_cast<uint64_t>(job.usage.ru_maxrss) / 1024U;	// which is in bytes here
+#else
+	metrics.max_rss_kib = static_cast<uint64_t>(job.usage.ru_maxrss);
+#endif
+	metrics.input_blocks = static_cast<uint64_t>(job.usage.ru_inblock);
+	metrics.output_blocks = static_cast<uint64_t>(job.usage.ru_oublock);
+#endif
+	job_metrics.store(job.arg, metrics);
+	if (!silent) {
+		msg(prog, "INFO") << job.arg << ": Redone.\n" << std::flush;
+	}
+	release_job_lock(job);
+	return true;
+}
 
-	RedoParentFDStack saved_parent(db_fd);
-	std::string dofile_name, dir(job.arg, static_cast<std::size_t>(b - job.arg)), base, ext;
-	if (!find_do_file(prog, meta_depth, job.arg, b, dofile_name, base, ext)) {
-		msg(prog, "ERROR") << job.arg << ": Cannot find .do file to use.\n";
-		close(db_fd);
-		close(lock_fd);
+/* Redo internals ***********************************************************
+// **************************************************************************
+*/
+
+static inline
+bool
+exists(
+	const std::string & name
+) {
+	return 0 <= access(name.c_str(), F_OK);
+}
+
+static inline
+bool
+satisfies_existence (
+	const char * prog,
+	const std::string & target_name
+) {
+	if (!exists(target_name)) {
+		if (verbose)
+			msg(prog, "INFO") << target_name << " needs rebuilding because it does not exist.\n";
 		return false;
 	}
-	const std::string fullbase(dir + base);
-	std::remove(job.tmp_target.c_str());
-#if defined(__OS2__) || defined(__WIN32__) || defined(__NT__)
-	if (ext.empty()) ext = ".";	// There is a bug in the Interix sh.bat that causes it to lose empty arguments.
-#endif
+	return true;
+}
 
-	job.lock_fd = lock_fd;
-	job.script = dofile_name;
+typedef std::vector<std::pair<Information, PathID> > Prerequisites;
+
+/// Read the records of a target's database, failing if there is none or it is corrupt.
+static inline
+bool
+read_prerequisites (
+	const char * prog,
+	const std::string & target_name,
+	Prerequisites & records
+) {
+	DatabaseReader database(target_name);
+	if (database.fail()) return false;
+	Information i;
+	const char * name;
+	std::size_t name_length;
+	while (database.next(i, name, name_length))
+		records.push_back(Prerequisites::value_type(i, paths.intern(name, name_length)));
+	if (database.corrupt()) {
+		if (verbose)
+			msg(prog, "INFO") << target_name << " needs rebuilding because its database is corrupt.\n";
+		return false;
+	}
+	return true;
+}
+
+/// Whether a prerequisite is as the database recorded it, explaining why not when verbose.
+static inline
+bool
+unchanged_prerequisite (
+	const char * prog,
+	const std::string & target_name,
+	const char * prereq_name,
+	const Information & db_info,
+	const Information & fs_info,
+	bool explain
+) {
+	if (db_info.type != fs_info.type) {
+		if (explain) {
+			msg(prog, "INFO") << target_name << " needs rebuilding because " << prereq_name;
+			if (fs_info.NOTHING == fs_info.type)
+				std::clog << " does not exist.\n";
+			else
+				std::clog << " has changed type.\n";
+		}
+		return false;
+	}
+	// Files are always compared by hash, which is cheap when the fingerprint matches, because the recorded hash is then re-used.
+	if (fs_info.NOTHING == fs_info.type
+	||  (fs_info.FILE != fs_info.type && same_timestamp(fs_info, db_info))
+	)
+		return true;
+	if (fs_info.SPECIAL == fs_info.type || fs_info.DIRECTORY == fs_info.type) {
+		if (explain) {
+			char fs_buf[64], db_buf[64];
+			struct std::tm fs_tm(*std::localtime(&fs_info.last_written));
+			struct std::tm db_tm(*std::localtime(&db_info.last_written));
+			std::strftime(fs_buf, sizeof fs_buf, "%F %T %z", &fs_tm);
+			std::strftime(db_buf, sizeof db_buf, "%F %T %z", &db_tm);
+			msg(prog, "INFO") << target_name << " needs rebuilding because " << prereq_name << " has changed timestamp from " << db_buf << " to " << fs_buf << ".\n";
+		}
+		return false;
+	}
+	if (0 != std::memcmp(fs_info.hash, db_info.hash, sizeof db_info.hash)) {
+		if (explain) {
+			msg(prog, "INFO") << target_name << " needs rebuilding because " << prereq_name << " has changed hash value from ";
+			puthash(std::clog, db_info);
+			std::clog << " to ";
+			puthash(std::clog, fs_info);
+			std::clog << ".\n";
+		}
+		return false;
+	}
+	return true;
+}
+
+enum PrerequisiteCheck { PREREQUISITE_UNCHANGED, PREREQUISITE_CHANGED, PREREQUISITE_NEEDS_HASH };
+
+/// Compare a prerequisite with the database as far as can be done without hashing its contents.
+/// Existence, type, size, and timestamps are compared, and a file whose fingerprint matches, or whose hash is in the hash cache, is compared by hash.
+/// Only a file that would have to be read is left undecided, and is added to the requests along with what stat()ing it found.
+static inline
+PrerequisiteCheck
+check_prerequisite_cheaply (
+	const char * prog,
+	const std::string & target_name,
+	PathID id,
+	const Information & db_info,
+	bool explain,
+	FileInfoRequests & needs_hash
+) {
+	const char * prereq_name(paths.name(id));
+	if (db_info.NO_DO_FILE == db_info.type) {
+		if (still_no_do_file(paths.str(id))) return PREREQUISITE_UNCHANGED;
+		if (explain)
+			msg(prog, "INFO") << target_name << " needs rebuilding because there is now a .do file for " << prereq_name << ".\n";
+		return PREREQUISITE_CHANGED;
+	}
+	if (db_info.FILE == db_info.type && UNKNOWN_HASH_ALGORITHM == db_info.hash_algorithm) {
+		if (explain)
+			msg(prog, "INFO") << target_name << " needs rebuilding because " << prereq_name << " was hashed with an unknown algorithm.\n";
+		return PREREQUISITE_CHANGED;
+	}
+	const HashAlgorithm algorithm(wanted_hash_algorithm(&db_info));
+	const Information * cached(file_info_cache.find(id));
+	if (!cached || (cached->FILE == cached->type && algorithm != cached->hash_algorithm)) {
+		Information fs_info;
+		struct stat stbuf;
+		if (stat_file_info(paths.str(id), &db_info, algorithm, fs_info, stbuf) && !lookup_cached_hash(stbuf, algorithm, fs_info.hash)) {
+			// A change of type or of size needs no hash to show it, and the information without a hash is not cached.
+			if (db_info.type != fs_info.type) {
+				unchanged_prerequisite(prog, target_name, prereq_name, db_info, fs_info, explain);
+				return PREREQUISITE_CHANGED;
+			}
+			if (db_info.has_fingerprint && db_info.size != fs_info.size) {
+				if (explain)
+					msg(prog, "INFO") << target_name << " needs rebuilding because " << prereq_name << " has changed size from " << db_info.size << " to " << fs_info.size << ".\n";
+				return PREREQUISITE_CHANGED;
+			}
+			FileInfoRequest r(id, &db_info);
+			r.stated = true;
+			r.info = fs_info;
+			r.version = stbuf;
+			needs_hash.push_back(r);
+			return PREREQUISITE_NEEDS_HASH;
+		}
+		cached = &file_info_cache.insert(id, fs_info);
+	}
+	return unchanged_prerequisite(prog, target_name, prereq_name, db_info, *cached, explain) ? PREREQUISITE_UNCHANGED : PREREQUISITE_CHANGED;
+}
+
+static inline
+bool
+satisfies_prerequisites (
+	const char * prog,
+	const std::string & target_name,
+	const Prerequisites & records
+) {
+	// Everything that can be decided without reading files is decided first, so that an out of date target is usually found without hashing anything.
+	// Only the files that still need their contents hashed are then hashed, together in one batch.
+	FileInfoRequests requests;
+	bool satisfaction(true);
+	for (Prerequisites::const_iterator r(records.begin()); r != records.end(); ++r) {
+		switch (check_prerequisite_cheaply(prog, target_name, r->second, r->first, verbose, requests)) {
+			case PREREQUISITE_UNCHANGED:
+			case PREREQUISITE_NEEDS_HASH:
+				break;
+			case PREREQUISITE_CHANGED:
+				satisfaction = false;
+				if (!keep_going) return false;
+				break;
+		}
+	}
+	batch_file_info(requests);
+	for (FileInfoRequests::const_iterator r(requests.begin()); r != requests.end(); ++r)
+		if (!unchanged_prerequisite(prog, target_name, paths.name(r->name), *r->old_info, get_file_info(r->name, r->old_info), verbose)) {
+			satisfaction = false;
+			if (!keep_going) return false;
+		}
+	return satisfaction;
+}
+
+static inline
+bool
+is_sourcefile(
+	PathID id
+) {
+	if (target_index.enabled()) return !target_index.known(id) && exists(paths.name(id));
+	const std::string name(paths.str(id));
+	if (log_database.enabled()) return !log_database.known(name) && exists(name);
+	if (!exists(name)) return false;
+	if (exists(".redo/" + name + ".prereqs")) return false;
+	if (exists(".redo/" + name + ".prereqsne")) return false;
+	if (exists(".redo/" + name + ".prereqs.build")) return false;
+	if (exists(".redo/" + name + ".prereqsne.build")) return false;
+	return true;
+}
+
+/* Gathering file information in parallel **********************************
+// **************************************************************************
+*/
+
+// Checking whether targets are up to date is mostly a matter of stat()ing and hashing their prerequisites, which is done by a pool of threads when there are enough of them.
+// Each thread needs a job slot, so that the total parallelism stays within what the jobserver allows.
+// The threads only produce information; it is added to the cache by the main thread once they have all finished.
+
+enum { MIN_FILES_PER_FILE_INFO_THREAD = 16, MAX_FILE_INFO_THREADS = 64, FILE_INFO_CHUNK = 64 };
 
 #if !defined(__OS2__) && !defined(__WIN32__) && !defined(__NT__)
-	const char * comspec(job.script.c_str());
+struct FileInfoWork {
+	FileInfoWork(const FileInfoRequests & r) : requests(r), results(r.size()), next(0) { pthread_mutex_init(&mutex, 0); }
+	~FileInfoWork() { pthread_mutex_destroy(&mutex); }
+	const FileInfoRequests & requests;
+	std::vector<Information> results;
+	pthread_mutex_t mutex;
+	std::size_t next;
+};
+
+static
+void *
+file_info_worker (
+	void * p
+) {
+	FileInfoWork & work(*static_cast<FileInfoWork *>(p));
+	// Requests are taken a chunk at a time, which lets small files still be hashed together.
+	for (;;) {
+		std::size_t j;
+		{
+			MutexLock lock(work.mutex);
+			j = work.next;
+			work.next += FILE_INFO_CHUNK;
+		}
+		if (j >= work.requests.size()) break;
+		const std::size_t count(work.requests.size() - j < FILE_INFO_CHUNK ? work.requests.size() - j : static_cast<std::size_t>(FILE_INFO_CHUNK));
+		read_file_infos(&work.requests[j], count, &work.results[j]);
+	}
+	return 0;
+}
 #endif
-	const char * argv[9] = {
+
+/// Populate the cache for all of the named files, using as many threads as there are job slots to be had.
+static
+void
+parallel_file_info (
+	const char * prog,
+	const FileInfoRequests & requests
+) {
+#if !defined(__OS2__) && !defined(__WIN32__) && !defined(__NT__)
+	unsigned slots(0U);
+	// The server, if there is one, has threads of its own.
+	while (-1 == file_info_server_fd
+	&&     slots < MAX_FILE_INFO_THREADS
+	&&     (slots + 1U) * MIN_FILES_PER_FILE_INFO_THREAD <= requests.size()
+	&&     try_procure_job_slot(prog)
+	)
+		++slots;
+	if (slots > 1U) {
+		HashingTimer timer;
+		FileInfoWork work(requests);
+		std::vector<pthread_t> threads;
+		// The main thread works as well, in the first of the slots.
+		for (unsigned j(1U); j < slots; ++j) {
+			pthread_t t;
+			if (0 != pthread_create(&t, 0, file_info_worker, &work)) break;
+			threads.push_back(t);
+		}
+		file_info_worker(&work);
+		for (std::vector<pthread_t>::const_iterator t(threads.begin()); t != threads.end(); ++t)
+			pthread_join(*t, 0);
+		for (std::size_t j(0); j < requests.size(); ++j)
+			if (!file_info_cache.find(requests[j].name))
+				file_info_cache.insert(requests[j].name, work.results[j]);
+	}
+	while (slots) {
+		vacate_job_slot(prog);
+		--slots;
+	}
+#else
+	static_cast<void>(prog);
+#endif
+	batch_file_info(requests);
+}
+
+/* Planning *****************************************************************
+// **************************************************************************
+*/
+
+// Rather than checking each target in turn, recursing through its prerequisites and building the graph one level at a time, the whole graph of targets reachable from the arguments is loaded from the database up-front, each target exactly once.
+// Each target is then checked as soon as all of the targets that it was last built from are done, and started as soon as it is found to need rebuilding.
+// Whether a target needs rebuilding cannot be decided before that point, because a prerequisite that is rebuilt might turn out to be unchanged.
+// Of the targets that need rebuilding, the one with the longest path of recorded running times still ahead of it, up to the targets named in the arguments, is started first, so that a long job near the bottom of the graph does not end up being started last.
+// Targets with no recorded times are started in the order that they were found.
+
+static inline
+void
+make_job (
+	Job & job,
+	PathID id
+) {
+	job.target = id;
+	job.arg = paths.name(id);
+	job.tmp_target = paths.str(id) + ".doing";
+	job.database_name = ".redo/" + paths.str(id) + ".prereqs";
+	job.tmp_database_name = log_database.enabled() ? log_database.temporary_name() : job.database_name + ".build";
+	job.lock_database_name = job.database_name + ".lock";
+}
+
+class Plan {
+public:
+	Plan(const char * p, unsigned d) :
+		prog(p), meta_depth(d), runnable_sequence(0), memory_in_use_kib(0), held_back(false), running(0), completed(0), status(true), unwatched(0)
+#if defined(__linux__) && defined(SYS_pidfd_open)
+		, events(-1), awaiting_slot(false)
+#endif
+	{}
+	~Plan();
+	void add(PathID, bool unconditional);
+	bool execute();
+	void watched(std::vector<PathID> &) const;
+protected:
+	static const std::size_t NO_NODE = static_cast<std::size_t>(-1);
+	enum { LOAD_RECHECK_MILLISECONDS = 1000 };
+	struct Node {
+		Node(PathID t) : target(t), loaded(false), must_build(false), unconditional(false), waiting(false), priority(0.0), memory_kib(0), pending(0), last_dependent(NO_NODE), job(0), pidfd(-1) {}
+		PathID target;
+		bool loaded;		///< whether the database has been read and the prerequisite targets added to the graph
+		bool must_build;	///< whether the target was known to need rebuilding as soon as it was loaded
+		bool unconditional;	///< whether the target is to be rebuilt whatever its state
+		bool waiting;		///< whether the process is a waiter for another process's build of the target, rather than a build
+		double priority;	///< the longest total of recorded running times on any path from here to an argument
+		uint64_t memory_kib;	///< the recorded peak memory use of the target's script
+		std::size_t pending;	///< the number of prerequisite targets that are not yet done
+		std::size_t last_dependent;	///< for ignoring repeated records of the same prerequisite
+		Prerequisites records;
+		std::vector<std::size_t> dependents;
+		Job * job;
+		int pidfd;	///< becomes readable when the job's process exits
+	};
+	const char * prog;
+	unsigned meta_depth;
 #if defined(__OS2__) || defined(__WIN32__) || defined(__NT__)
-		comspec,
-		"/c",
-		"sh",
-		"-e",
+	const char * comspec;
 #endif
-		dofile_name.c_str(),
-		fullbase.c_str(),
-		ext.c_str(),
-		job.tmp_target.c_str(),
-		NULL
+	std::vector<Node> nodes;
+	std::vector<std::size_t> node_of;	///< indexed by path ID
+	struct Runnable {
+		Runnable(double p, std::size_t s, std::size_t n) : priority(p), sequence(s), node(n) {}
+		double priority;
+		std::size_t sequence;
+		std::size_t node;
+		bool operator < (const Runnable & o) const { return priority < o.priority || (priority == o.priority && sequence > o.sequence); }
 	};
-	std::vector<const char *> envv;
-	for (char **e(environ); *e; ++e)
-		envv.push_back(*e);
-	std::ostringstream redoflags;
-	redoflags << "REDOFLAGS=";
-	if (keep_going) redoflags << " --keep-going";
-	if (debug) redoflags << " --debug";
-	if (silent) redoflags << " --silent";
-	if (verbose) redoflags << " --verbose";
-	if (-1 != db_fd) redoflags << " --redoparent-fd=" << db_fd;
-	if (-1 != jobserver_fds[0]) {
-		redoflags << " --jobserver-fds=" << jobserver_fds[0];
-		if (-1 != jobserver_fds[1])
-			redoflags << "," << jobserver_fds[1];
+	std::deque<std::size_t> ready;
+	std::priority_queue<Runnable> runnable;
+	std::size_t runnable_sequence;
+	uint64_t memory_in_use_kib;	///< the total recorded peak memory use of the running scripts
+	bool held_back;	///< whether no runnable target fits in the memory budget until a running one finishes
+	std::list<Job> jobs;
+	std::map<int, std::size_t> active;	///< the nodes of running jobs, by process ID
+	std::size_t running, completed;
+	bool status;
+	std::size_t unwatched;	///< the number of running jobs that have no pidfd
+#if defined(__linux__) && defined(SYS_pidfd_open)
+	int events;	///< an epoll instance for job exits and the jobserver
+	bool awaiting_slot;
+#endif
+	std::size_t node(PathID);
+	void load(std::size_t);
+	void gather(const std::deque<std::size_t> &);
+	void prioritize();
+	void check(std::size_t);
+	void make_runnable(std::size_t n) { runnable.push(Runnable(nodes[n].priority, runnable_sequence++, n)); }
+	bool admit(Runnable &);
+	void start(std::size_t);
+	void track(std::size_t);
+	void wait_for_lock(std::size_t);
+	bool await();
+	void reap(std::size_t, int);
+	void done(std::size_t, bool);
+};
+
+const std::size_t Plan::NO_NODE;
+
+Plan::~Plan()
+{
+#if defined(__linux__) && defined(SYS_pidfd_open)
+	if (-1 != events) close(events);
+#endif
+}
+
+std::size_t
+Plan::node(
+	PathID id
+) {
+	if (id >= node_of.size()) node_of.resize(id + 1U, NO_NODE);
+	if (NO_NODE == node_of[id]) {
+		node_of[id] = nodes.size();
+		nodes.push_back(Node(id));
 	}
-	const std::string redoflags_str(redoflags.str());
-	envv.push_back(redoflags_str.c_str());
-	envv.push_back(0);
+	return node_of[id];
+}
+
+/// Load the graph below a target, depth first.
+void
+Plan::load(
+	std::size_t root
+) {
+	std::vector<std::size_t> stack(1U, root);
+	while (!stack.empty()) {
+		const std::size_t n(stack.back());
+		stack.pop_back();
+		if (nodes[n].loaded) continue;
+		nodes[n].loaded = true;
+		const std::string name(paths.str(nodes[n].target));
+		// A target that does not exist is rebuilt without regard to its prerequisites, which its .do script will bring up to date itself.
+		if (!satisfies_existence(prog, name) || !read_prerequisites(prog, name, nodes[n].records)) {
+			nodes[n].must_build = true;
+			nodes[n].records.clear();
+			continue;
+		}
+		for (Prerequisites::const_iterator r(nodes[n].records.begin()); r != nodes[n].records.end(); ++r) {
+			if (r->first.NOTHING == r->first.type || r->first.NO_DO_FILE == r->first.type) continue;
+			if (is_sourcefile(r->second)) continue;
+			const std::size_t c(node(r->second));
+			if (c == n || nodes[c].last_dependent == n) continue;
+			nodes[c].last_dependent = n;
+			nodes[c].dependents.push_back(n);
+			++nodes[n].pending;
+			if (!nodes[c].loaded) stack.push_back(c);
+		}
+	}
+}
+
+void
+Plan::add(
+	PathID id,
+	bool unconditional
+) {
+	const std::size_t n(node(id));
+	if (nodes[n].loaded) return;
+	if (unconditional) {
+		nodes[n].loaded = nodes[n].must_build = nodes[n].unconditional = true;
+		return;
+	}
+	load(n);
+}
+
+/// Obtain the information about the prerequisites of all of the targets about to be checked, in one go.
+void
+Plan::gather(
+	const std::deque<std::size_t> & batch
+) {
+	FileInfoRequests requests, wanted;
+	std::vector<bool> requested;
+	for (std::deque<std::size_t>::const_iterator n(batch.begin()); n != batch.end(); ++n) {
+		if (nodes[*n].must_build) continue;
+		// Only the files that have to be hashed are gathered in parallel, and none at all for a target that the other prerequisites already show to be out of date.
+		const std::string name(paths.str(nodes[*n].target));
+		const Prerequisites & records(nodes[*n].records);
+		bool changed(false);
+		wanted.clear();
+		for (Prerequisites::const_iterator r(records.begin()); !changed && r != records.end(); ++r) {
+			if (r->second < requested.size() && requested[r->second]) continue;
+			if (PREREQUISITE_CHANGED == check_prerequisite_cheaply(prog, name, r->second, r->first, false, wanted))
+				changed = true;
+		}
+		if (changed) continue;
+		for (FileInfoRequests::const_iterator r(wanted.begin()); r != wanted.end(); ++r) {
+			if (r->name >= requested.size()) requested.resize(r->name + 1U, false);
+			if (requested[r->name]) continue;
+			requested[r->name] = true;
+			requests.push_back(*r);
+		}
+	}
+	if (!requests.empty())
+		parallel_file_info(prog, requests);
+}
+
+/// Work out the priority of every node from the recorded running times, dependents before the targets that they depend from.
+void
+Plan::prioritize()
+{
+	enum { UNVISITED, VISITING, VISITED };
+	std::vector<char> state(nodes.size(), UNVISITED);
+	std::vector<std::size_t> stack;
+	for (std::size_t root(0); root < nodes.size(); ++root) {
+		stack.push_back(root);
+		while (!stack.empty()) {
+			const std::size_t n(stack.back());
+			if (UNVISITED == state[n]) {
+				state[n] = VISITING;
+				for (std::vector<std::size_t>::const_iterator d(nodes[n].dependents.begin()); d != nodes[n].dependents.end(); ++d)
+					if (UNVISITED == state[*d])
+						stack.push_back(*d);
+				continue;
+			}
+			stack.pop_back();
+			if (VISITED == state[n]) continue;
+			state[n] = VISITED;
+			double longest(0.0);
+			// A dependent that is still being visited is part of a cycle, and contributes nothing.
+			for (std::vector<std::size_t>::const_iterator d(nodes[n].dependents.begin()); d != nodes[n].dependents.end(); ++d)
+				if (VISITED == state[*d] && nodes[*d].priority > longest)
+					longest = nodes[*d].priority;
+			const JobMetrics::Entry * metrics(job_metrics.find(paths.str(nodes[n].target)));
+			nodes[n].priority = longest + (metrics ? metrics->wall_seconds : 0.0);
+			nodes[n].memory_kib = metrics ? metrics->max_rss_kib : 0U;
+		}
+	}
+}
+
+/// Decide whether a target whose prerequisites are all done needs rebuilding.
+void
+Plan::check(
+	std::size_t n
+) {
+	const std::string name(paths.str(nodes[n].target));
+	if (nodes[n].must_build
+	||  !satisfies_existence(prog, name)
+	||  !satisfies_prerequisites(prog, name, nodes[n].records)
+	)
+		make_runnable(n);
+	else
+		done(n, true);
+}
+
+/// Take the most urgent runnable target whose script would, going by its recorded peak memory use, fit in what remains of the memory budget.
+// Nothing fits in a budget that is already used up, except when nothing is running at all, which would otherwise mean waiting forever.
+bool
+Plan::admit(
+	Runnable & chosen
+) {
+	const uint64_t budget_kib(static_cast<uint64_t>(max_memory_mib) * 1024U);
+	std::vector<Runnable> unfit;
+	bool found(false);
+	while (!runnable.empty()) {
+		const Runnable r(runnable.top());
+		runnable.pop();
+		if (!budget_kib || !running || memory_in_use_kib + nodes[r.node].memory_kib <= budget_kib) {
+			chosen = r;
+			found = true;
+			break;
+		}
+		unfit.push_back(r);
+	}
+	for (std::vector<Runnable>::const_iterator r(unfit.begin()); r != unfit.end(); ++r)
+		runnable.push(*r);
+	if (!found) {
+		held_back = true;
+		if (verbose)
+			msg(prog, "INFO") << "Holding back " << unfit.size() << " job(s) that would exceed the memory budget.\n";
+	}
+	return found;
+}
 
-	if (verbose)
-		msg(prog, "INFO") << "spawn: " << dofile_name << " " << fullbase << " " << ext << " " << job.tmp_target << "\n" << std::flush;
-	job.pid = spawnve(P_NOWAIT, comspec, argv, const_cast<const char **>(&envv.front()));
-	close(db_fd);
+void
+Plan::start(
+	std::size_t n
+) {
+	jobs.push_back(Job());
+	Job & job(jobs.back());
+	make_job(job, nodes[n].target);
+	nodes[n].job = &job;
+#if defined(__OS2__) || defined(__WIN32__) || defined(__NT__)
+	if (!run(comspec, prog, meta_depth, job)) {
+#else
+	if (!run(prog, meta_depth, job)) {
+#endif
+		vacate_job_slot(prog);
+		if (job.busy)
+			wait_for_lock(n);
+		else
+			done(n, false);
+	} else if (0 > job.pid) {
+		const int error(errno);
+		msg(prog, "ERROR") << job.script << ": " << std::strerror(error) << "\n";
+		vacate_job_slot(prog);
+		done(n, false);
+	} else {
+		memory_in_use_kib += nodes[n].memory_kib;
+		track(n);
+	}
+}
 
-	return true;
+/// Add the process of a node to those being awaited.
+void
+Plan::track(
+	std::size_t n
+) {
+	const int pid(nodes[n].job->pid);
+	active[pid] = n;
+	++running;
+#if defined(__linux__) && defined(SYS_pidfd_open)
+	if (-1 != events) {
+		const int fd(syscall(SYS_pidfd_open, pid, 0));
+		struct epoll_event e;
+		e.events = EPOLLIN;
+		e.data.u64 = n;
+		if (0 <= fd && 0 <= epoll_ctl(events, EPOLL_CTL_ADD, fd, &e))
+			nodes[n].pidfd = fd;
+		else if (0 <= fd)
+			close(fd);
+	}
+#endif
+	if (-1 == nodes[n].pidfd) ++unwatched;
 }
 
-static inline
-bool
-finish (
-	const char * prog,
-	Job & job,
-	int exit_status
+/// Wait, without a job slot, for another process to finish building a target, so that it need not be built again here.
+// The waiting is done by a child process that blocks until it acquires the lock, and then exits, releasing it.
+void
+Plan::wait_for_lock(
+	std::size_t n
 ) {
-	job.pid = -1;
-	if (!WIFEXITED(exit_status) || (0 < WEXITSTATUS(exit_status))) {
-		msg(prog, "ERROR") << job.target << ": Not done.\n";
-		rmrf(job.tmp_target.c_str());
-		close(job.lock_fd); 
-		return false;
+#if !defined(__OS2__) && !defined(__WIN32__) && !defined(__NT__)
+	Job & job(*nodes[n].job);
+	if (verbose)
+		msg(prog, "INFO") << job.arg << " is being built by another process.\n";
+	job.pid = fork();
+	if (0 > job.pid) {
+		const int error(errno);
+		msg(prog, "ERROR") << "fork: " << std::strerror(error) << "\n";
+		done(n, false);
+		return;
 	}
-	struct stat stbuf;
-	if (0 > posix_lstat(job.tmp_target.c_str(), &stbuf)) {
-		std::ofstream tmp(job.tmp_target.c_str(), std::ios::app);
+	if (0 == job.pid) {
+		const bool locked(acquire_job_lock(prog, job, true));
+		_exit(locked ? EXIT_SUCCESS : EXIT_FAILURE);
 	}
-	if ((0 <= posix_lstat(job.target.c_str(), &stbuf)) && S_ISDIR(stbuf.st_mode)) {
-		if (0 > rmrf(job.target.c_str())) {
+	nodes[n].waiting = true;
+	track(n);
+#else
+	done(n, false);
+#endif
+}
+
+/// Wait for a running job to finish or, if there are jobs waiting to start, for a job slot to become available.
+// Where every running job has a pidfd, the waiting is done with epoll, which yields the node of each exited job directly.
+// Otherwise there is only waitpid(), which cannot also wait for the jobserver.
+bool
+Plan::await()
+{
+#if defined(__linux__) && defined(SYS_pidfd_open)
+	if (-1 != events && 0 == unwatched) {
+		// A slot refused because of the load average is tried for again after a while, rather than whenever the jobserver has one.
+		const bool want_slot(!runnable.empty() && !held_back && !load_throttled && -1 != jobserver_fds[0]);
+		if (want_slot != awaiting_slot) {
+			struct epoll_event e;
+			e.events = EPOLLIN;
+			e.data.u64 = NO_NODE;
+			epoll_ctl(events, want_slot ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, jobserver_fds[0], &e);
+			awaiting_slot = want_slot;
+		}
+		struct epoll_event ready_events[64];
+		const int r(epoll_wait(events, ready_events, sizeof ready_events/sizeof *ready_events, load_throttled && !runnable.empty() ? LOAD_RECHECK_MILLISECONDS : -1));
+		if (0 > r) {
 			const int error(errno);
-			msg(prog, "ERROR") << job.target << ": Unable to remove contents of target directory: " << std::strerror(error) << "\n";
-			rmrf(job.tmp_target.c_str());
-			close(job.lock_fd); 
+			if (EINTR == error) return true;
+			msg(prog, "ERROR") << "epoll_wait: " << std::strerror(error) << "\n";
 			return false;
 		}
+		for (int i(0); i < r; ++i) {
+			const std::size_t n(static_cast<std::size_t>(ready_events[i].data.u64));
+			if (NO_NODE == n) continue;	// The caller will try for the job slot.
+			if (-1 == nodes[n].pidfd) continue;
+			int exit_status;
+			if (0 > wait4(nodes[n].job->pid, &exit_status, 0, &nodes[n].job->usage)) {
+				const int error(errno);
+				msg(prog, "ERROR") << nodes[n].job->pid << ": " << std::strerror(error) << "\n";
+				return false;
+			}
+			reap(n, exit_status);
+		}
+		return true;
 	}
-	delete_file_info(job.target);
-	if (0 > posix_rename(job.tmp_database_name.c_str(), job.database_name.c_str())) {
-		const int error(errno);
-		msg(prog, "ERROR") << job.tmp_database_name << ": Unable to rename database file: " << std::strerror(error) << "\n";
-		rmrf(job.tmp_target.c_str());
-		close(job.lock_fd); 
-		return false;
-	}
-	if (0 > posix_rename(job.tmp_target.c_str(), job.target.c_str())) {
+#endif
+	int exit_status;
+#if !defined(__OS2__) && !defined(__WIN32__) && !defined(__NT__)
+	struct rusage usage;
+	const int pid(wait4(-1, &exit_status, 0, &usage));
+#else
+	const int pid(waitpid(-1, &exit_status, 0));
+#endif
+	if (0 > pid) {
 		const int error(errno);
-		msg(prog, "ERROR") << job.target << ": Unable to rename target file: " << std::strerror(error) << "\n";
-		rmrf(job.tmp_target.c_str());
-		close(job.lock_fd); 
+		if (EINTR == error) return true;
+		msg(prog, "ERROR") << std::strerror(error) << "\n";
 		return false;
 	}
-	if (!silent) {
-		msg(prog, "INFO") << job.target << ": Redone.\n" << std::flush;
+	const std::map<int, std::size_t>::const_iterator i(active.find(pid));
+	if (active.end() == i) {
+		msg(prog, "ERROR") << "Unknown child process ID " << pid << ".\n";
+		return true;
 	}
-	close(job.lock_fd); 
+#if !defined(__OS2__) && !defined(__WIN32__) && !defined(__NT__)
+	nodes[i->second].job->usage = usage;
+#endif
+	reap(i->second, exit_status);
 	return true;
 }
 
-static inline
-bool
-run (
-	const char * prog,
-	unsigned meta_depth,
-	std::list<Job> & jobs
+void
+Plan::reap(
+	std::size_t n,
+	int exit_status
+) {
+	Job & job(*nodes[n].job);
+	active.erase(job.pid);
+	--running;
+	held_back = false;
+	if (-1 != nodes[n].pidfd) {
+#if defined(__linux__) && defined(SYS_pidfd_open)
+		// A child that has not yet execed holds a duplicate of the pidfd, which would keep it in the epoll set after it is closed.
+		epoll_ctl(events, EPOLL_CTL_DEL, nodes[n].pidfd, 0);
+#endif
+		close(nodes[n].pidfd);
+		nodes[n].pidfd = -1;
+	} else
+		--unwatched;
+	if (nodes[n].waiting) {
+		nodes[n].waiting = false;
+		job.pid = -1;
+		if (!WIFEXITED(exit_status) || EXIT_SUCCESS != WEXITSTATUS(exit_status)) {
+			done(n, false);
+			return;
+		}
+		// The other process has committed its build, so the target is checked again as it now stands.
+		delete_file_info(nodes[n].target);
+		if (nodes[n].unconditional)
+			make_runnable(n);
+		else {
+			nodes[n].records.clear();
+			const std::string name(paths.str(nodes[n].target));
+			nodes[n].must_build = !satisfies_existence(prog, name) || !read_prerequisites(prog, name, nodes[n].records);
+			check(n);
+		}
+		return;
+	}
+	memory_in_use_kib -= nodes[n].memory_kib;
+	const bool ok(finish(prog, job, exit_status));
+	vacate_job_slot(prog);
+	done(n, ok);
+}
+
+void
+Plan::done(
+	std::size_t n,
+	bool ok
 ) {
-	bool status = true;
+	if (!ok) status = false;
+	++completed;
+	for (std::vector<std::size_t>::const_iterator d(nodes[n].dependents.begin()); d != nodes[n].dependents.end(); ++d)
+		if (0 == --nodes[*d].pending)
+			ready.push_back(*d);
+}
+
+bool
+Plan::execute()
+{
 #if defined(__OS2__) || defined(__WIN32__) || defined(__NT__)
-	const char * comspec(std::getenv("COMSPEC"));
+	comspec = std::getenv("COMSPEC");
 	if (!comspec) {
 		msg(prog, "ERROR") << "Cannot find command interpreter.\n";
 		return false;
 	}
 #endif
-	std::list<Job>::iterator bi(jobs.begin()), ri(bi), ai(ri), ei(jobs.end());
-	while (ai != ei) {
+#if defined(__linux__) && defined(SYS_pidfd_open)
+	if (-1 == events) events = epoll_create1(EPOLL_CLOEXEC);
+#endif
+	prioritize();
+	for (std::size_t n(0); n < nodes.size(); ++n)
+		if (0 == nodes[n].pending)
+			ready.push_back(n);
+	for (;;) {
+		while (!ready.empty()) {
+			std::deque<std::size_t> batch;
+			batch.swap(ready);
+			gather(batch);
+			for (std::deque<std::size_t>::const_iterator n(batch.begin()); n != batch.end(); ++n)
+				check(*n);
+		}
 		if (debug) {
-			if (ri != ei)
+			if (!runnable.empty())
 				msg(prog, "INFO") << "Jobs still available to start.\n";
-			if (ai != ri)
+			if (running)
 				msg(prog, "INFO") << "Jobs still available to await.\n";
 		}
-		while ((ri != ei) && try_procure_job_slot(prog)) {
-			if (!run(prog, meta_depth, *ri)) {
-				status = false;
-				vacate_job_slot(prog);
-			} else if (0 > ri->pid) {
-				const int error(errno);
-				msg(prog, "ERROR") << ri->script << ": " << std::strerror(error) << "\n";
-				status = false;
-				vacate_job_slot(prog);
+		// With nothing running, there is nothing to await but a job slot.
+		Runnable r(0.0, 0, NO_NODE);
+		if (!runnable.empty() && !held_back && admit(r)) {
+			if (running ? try_procure_job_slot(prog) : procure_job_slot(prog)) {
+				start(r.node);
+				continue;
 			}
-			++ri;
+			runnable.push(r);
 		}
-		while ((ai != ri) && (0 > ai->pid)) {
-			++ai;
+		if (!running) break;
+		if (!await()) {
+			status = false;
+			break;
 		}
-		if (ai != ri) {
-			int exit_status;
-			const int pid(waitpid(-1, &exit_status, 0));
-			if (0 > pid) {
-				const int error(errno);
-				msg(prog, "ERROR") << std::strerror(error) << "\n";
-				status = false;
-				continue;
-			}
-			bool found = false;
-			for ( std::list<Job>::iterator i(ai); i != ri; ++i ) {
-				if (pid == i->pid) {
-					if (!finish(prog, *i, exit_status))
-						status = false;
-					found = true;
-				}
-			}
-			if (!found) {
-				msg(prog, "ERROR") << "Unknown child process ID " << pid << ".\n";
-			}
-			vacate_job_slot(prog);
+	}
+	if (completed < nodes.size()) {
+		for (std::size_t n(0); n < nodes.size(); ++n)
+			if (nodes[n].pending)
+				msg(prog, "ERROR") << paths.name(nodes[n].target) << ": Prerequisites form a cycle, or could not be built.\n";
+		status = false;
+	}
+	return status;
+}
+
+/// List every target in the graph and everything that each was built from, for watching.
+void
+Plan::watched(
+	std::vector<PathID> & names
+) const {
+	for (std::vector<Node>::const_iterator n(nodes.begin()); n != nodes.end(); ++n) {
+		names.push_back(n->target);
+		for (Prerequisites::const_iterator r(n->records.begin()); r != n->records.end(); ++r)
+			names.push_back(r->second);
+	}
+}
+
+static
+bool
+redo (
+	bool unconditional,
+	const char * prog,
+	unsigned meta_depth,
+	const std::vector<const char *> & filev
+) {
+	if (meta_depth >= MAX_META_DEPTH) return true;
+	if (debug) {
+		msg(prog, "INFO") << "REDO" << (unconditional ? "" : "-IFCHANGE-INTERNAL") << ": >";
+		for ( std::vector<const char *>::const_iterator i = filev.begin(); i != filev.end(); ++i ) {
+			const char * arg(*i);
+			std::clog << ' ';
+			if (!is_root_or_ends_with_dot_or_dotdot(arg) && is_sourcefile(paths.intern(arg))) std::clog << "(" << arg << ")"; else std::clog << arg;
 		}
+		std::clog << '<' << std::endl;
+	}
+
+	Plan plan(prog, meta_depth);
+	for ( std::vector<const char *>::const_iterator i = filev.begin(); i != filev.end(); ++i ) {
+		if (is_root_or_ends_with_dot_or_dotdot(*i)) continue; // Treat as source files, because they always exist.
+		const PathID id(paths.intern(*i));
+		if (is_sourcefile(id)) continue;
+		plan.add(id, unconditional);
+	}
+	const bool status(plan.execute());
+	if (debug) {
+		msg(prog, "INFO") << "Redo status = " << status << ".\n" << std::flush;
 	}
 	return status;
 }
 
-/* Redo internals ***********************************************************
+/* Watching for changes *****************************************************
 // **************************************************************************
 */
 
-static inline
+// redo --watch builds its targets, and then rebuilds whichever of them are out of date every time that something that they were built from changes.
+// Rather than watching each prerequisite, the directories that they are in are watched, which also catches prerequisites that do not yet exist and files that are replaced by renaming.
+// The events keep the file information cache valid, so nothing that has not changed is examined again.
+// A change to a target, which is usually made by a build, only invalidates its cached information; it is changes to source files and .do files that trigger a rebuild.
+
+#if defined(__linux__)
+enum {
+	WATCH_SETTLE_MILLISECONDS = 100,	///< how long to wait for a burst of changes to end
+	WATCH_EVENTS = IN_CLOSE_WRITE|IN_MODIFY|IN_ATTRIB|IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO
+};
+
+class Watcher {
+public:
+	Watcher() : fd(-1) {}
+	~Watcher() { if (-1 != fd) close(fd); }
+	bool open(const char * prog);
+	void watch(const char * prog, const std::vector<PathID> &);
+	bool wait(const char * prog);
+protected:
+	int fd;
+	std::map<int, std::string> directories;	///< by watch descriptor
+	std::set<std::string> watched;
+	std::vector<bool> prerequisite;	///< indexed by path ID
+	bool read_events(const char * prog, bool & changed);
+	bool poll_events(const char * prog, int timeout, bool & readable);
+};
+
 bool
-exists(
-	const std::string & name
+Watcher::open(
+	const char * prog
 ) {
-	return 0 <= access(name.c_str(), F_OK);
+	fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+	if (0 > fd) {
+		const int error(errno);
+		msg(prog, "ERROR") << "inotify_init1: " << std::strerror(error) << "\n";
+		return false;
+	}
+	return true;
 }
 
-static inline
-bool
-satisfies_existence (
+/// Watch the directories of everything in the list, which replaces the previous list.
+void
+Watcher::watch(
 	const char * prog,
-	const std::string & target_name
+	const std::vector<PathID> & names
 ) {
-	if (!exists(target_name)) {
-		if (verbose)
-			msg(prog, "INFO") << target_name << " needs rebuilding because it does not exist.\n";
-		return false;
+	prerequisite.assign(prerequisite.size(), false);
+	for (std::vector<PathID>::const_iterator i(names.begin()); i != names.end(); ++i) {
+		if (*i >= prerequisite.size()) prerequisite.resize(*i + 1U, false);
+		prerequisite[*i] = true;
+		const char * name(paths.name(*i));
+		const char * b(basename_of(name));
+		const std::string directory(b == name ? "." : b == name + 1 ? "/" : std::string(name, static_cast<std::size_t>(b - name - 1)));
+		if (!watched.insert(directory).second) continue;
+		const int wd(inotify_add_watch(fd, directory.c_str(), WATCH_EVENTS|IN_ONLYDIR));
+		if (0 > wd) {
+			const int error(errno);
+			if (ENOENT != error)
+				msg(prog, "WARNING") << directory << ": " << std::strerror(error) << "\n";
+			watched.erase(directory);
+			continue;
+		}
+		directories[wd] = directory;
 	}
-	return true;
 }
 
-static inline
+/// Apply whatever events are queued to the caches, noting whether any of them should trigger a rebuild.
 bool
-satisfies_prerequisites (
+Watcher::read_events(
 	const char * prog,
-	const std::string & target_name
+	bool & changed
 ) {
-	const std::string database_name(".redo/" + target_name + ".prereqs");
-	std::ifstream file(database_name.c_str());
-	if (file.fail()) return false;
-	bool satisfaction(true);
-	while (EOF != file.peek()) {
-		Information db_info;
-		std::string prereq_name;
-		read_db_line(file, db_info, prereq_name);
-		const Information & fs_info(get_file_info(prereq_name, &db_info));
-		if (db_info.type != fs_info.type) {
-			if (verbose) {
-				msg(prog, "INFO") << target_name << " needs rebuilding because " << prereq_name;
-				if (fs_info.NOTHING == fs_info.type)
-					std::clog << " does not exist.\n";
-				else
-					std::clog << " has changed type.\n";
+	union {
+		struct inotify_event event;
+		char bytes[64U * 1024U];
+	} buf;
+	for (;;) {
+		const int n(read(fd, buf.bytes, sizeof buf.bytes));
+		if (0 > n) {
+			const int error(errno);
+			if (EINTR == error) continue;
+			if (EAGAIN == error || EWOULDBLOCK == error) return true;
+			msg(prog, "ERROR") << "inotify: " << std::strerror(error) << "\n";
+			return false;
+		}
+		for (int off(0); off < n; ) {
+			const struct inotify_event & e(*reinterpret_cast<const struct inotify_event *>(buf.bytes + off));
+			off += sizeof e + e.len;
+			if (e.mask & IN_Q_OVERFLOW) {
+				// Some events have been lost, so nothing that is cached can be trusted.
+				file_info_cache.clear();
+				directory_listings.clear();
+				changed = true;
+				continue;
 			}
-			satisfaction = false;
-			if (!keep_going) break;
-		} else
-		if (fs_info.NOTHING != fs_info.type
-		&&  fs_info.last_written != db_info.last_written
-		) {
-			if (fs_info.SPECIAL == fs_info.type || fs_info.DIRECTORY == fs_info.type) {
-				if (verbose) {
-					char fs_buf[64], db_buf[64];
-					struct std::tm fs_tm(*std::localtime(&fs_info.last_written));
-					struct std::tm db_tm(*std::localtime(&db_info.last_written));
-					std::strftime(fs_buf, sizeof fs_buf, "%F %T %z", &fs_tm);
-					std::strftime(db_buf, sizeof db_buf, "%F %T %z", &db_tm);
-					msg(prog, "INFO") << target_name << " needs rebuilding because " << prereq_name << " has changed timestamp from " << db_buf << " to " << fs_buf << ".\n";
-				}
-				satisfaction = false;
-				if (!keep_going) break;
+			const std::map<int, std::string>::iterator d(directories.find(e.wd));
+			if (directories.end() == d) continue;
+			if (e.mask & IN_IGNORED) {
+				watched.erase(d->second);
+				directories.erase(d);
+				continue;
+			}
+			if (!e.len) continue;
+			const std::string name("." == d->second ? std::string(e.name) : d->second + "/" + e.name);
+			const PathID id(paths.intern(name));
+			delete_file_info(id);
+			if (is_do_file_name(e.name, std::strlen(e.name))) {
+				invalidate_directory_listing(name);
+				changed = true;
 			} else
-			if (0 != std::memcmp(fs_info.hash, db_info.hash, sizeof db_info.hash)) {
-				if (verbose) {
-					msg(prog, "INFO") << target_name << " needs rebuilding because " << prereq_name << " has changed hash value from ";
-					puthash(std::clog, db_info);
-					std::clog << " to ";
-					puthash(std::clog, fs_info);
-					std::clog << ".\n";
+			if (id < prerequisite.size() && prerequisite[id]) {
+				if ((e.mask & (IN_DELETE|IN_MOVED_FROM)) || is_sourcefile(id)) {
+					if (verbose)
+						msg(prog, "INFO") << name << " has changed.\n";
+					changed = true;
 				}
-				satisfaction = false;
-				if (!keep_going) break;
 			}
 		}
 	}
-	return satisfaction;
 }
 
-static inline
 bool
-is_sourcefile(
-	const std::string & name
+Watcher::poll_events(
+	const char * prog,
+	int timeout,
+	bool & readable
 ) {
-	if (!exists(name)) return false;
-	if (exists(".redo/" + name + ".prereqs")) return false;
-	if (exists(".redo/" + name + ".prereqsne")) return false;
-	if (exists(".redo/" + name + ".prereqs.build")) return false;
-	if (exists(".redo/" + name + ".prereqsne.build")) return false;
+	pollfd p;
+	p.fd = fd;
+	p.events = POLLIN;
+	const int r(poll(&p, 1, timeout));
+	if (0 > r) {
+		const int error(errno);
+		if (EINTR == error) return true;
+		msg(prog, "ERROR") << "poll: " << std::strerror(error) << "\n";
+		return false;
+	}
+	readable = 0 < r;
 	return true;
 }
 
-static inline
+/// Wait until something that should trigger a rebuild changes, and then until the burst of changes is over.
 bool
-recurse_prerequisites (
-	const char * prog,
-	unsigned meta_depth,
-	const std::string & name
+Watcher::wait(
+	const char * prog
 ) {
-	const std::string database_name(".redo/" + name + ".prereqs");
-	std::ifstream file(database_name.c_str());
-	if (file.fail()) return false;
-	std::list<std::string> files;
-	while (EOF != file.peek()) {
-		Information info;
-		std::string prereq_name;
-		read_db_line(file, info, prereq_name);
-		if (info.NOTHING != info.type && !is_sourcefile(prereq_name))
-			files.push_back(prereq_name);
+	bool changed(false);
+	if (!read_events(prog, changed)) return false;	// what the last build did
+	while (!changed) {
+		bool readable(false);
+		if (!poll_events(prog, -1, readable)) return false;
+		if (readable && !read_events(prog, changed)) return false;
+	}
+	for (bool readable(true); readable; ) {
+		readable = false;
+		if (!poll_events(prog, WATCH_SETTLE_MILLISECONDS, readable)) return false;
+		bool ignored(false);
+		if (readable && !read_events(prog, ignored)) return false;
 	}
-	return files.empty() || redo(false, prog, meta_depth, convert(files));
+	return true;
 }
+#endif
 
 static
 bool
-redo (
-	bool unconditional,
+watch (
 	const char * prog,
 	unsigned meta_depth,
 	const std::vector<const char *> & filev
 ) {
-	if (meta_depth >= MAX_META_DEPTH) return true;
-	bool status(true);
-	if (debug) {
-		msg(prog, "INFO") << "REDO" << (unconditional ? "" : "-IFCHANGE-INTERNAL") << ": >";
+#if defined(__linux__)
+	Watcher watcher;
+	if (!watcher.open(prog)) return false;
+	for (bool unconditional(true); ; unconditional = false) {
+		const bool status(redo(unconditional, prog, meta_depth, filev));
+		if (!silent)
+			msg(prog, "INFO") << (status ? "Build done" : "Build failed") << "; watching for changes.\n" << std::flush;
+		// The graph is loaded afresh, because the build will have recorded prerequisites that were not known beforehand.
+		Plan plan(prog, meta_depth);
 		for ( std::vector<const char *>::const_iterator i = filev.begin(); i != filev.end(); ++i ) {
-			const char * arg(*i);
-			std::clog << ' ';
-			if (is_sourcefile(arg)) std::clog << "(" << arg << ")"; else std::clog << arg;
-		}
-		std::clog << '<' << std::endl;
-	}
-
-	std::list<Job> jobs;
-
-	for ( std::vector<const char *>::const_iterator i = filev.begin(); i != filev.end(); ++i ) {
-		const char * arg(*i);
-		if (is_root_or_ends_with_dot_or_dotdot(arg)) continue; // Treat as source files, because they always exist.
-		if (is_sourcefile(arg)) continue;
-		if (!unconditional) {
-			if (satisfies_existence(prog, arg)) {
-				if (recurse_prerequisites(prog, meta_depth, arg)
-				&&  satisfies_existence(prog, arg)
-				&&  satisfies_prerequisites(prog, arg)
-				)
-					continue;
-			}
+			if (is_root_or_ends_with_dot_or_dotdot(*i)) continue;
+			const PathID id(paths.intern(*i));
+			if (is_sourcefile(id)) continue;
+			plan.add(id, false);
 		}
-
-		jobs.push_back(Job());
-		Job & job(jobs.back());
-		job.arg = arg;
-		job.target = arg;
-		job.tmp_target = job.target + ".doing";
-		job.database_name = ".redo/" + job.target + ".prereqs";
-		job.tmp_database_name = job.database_name + ".build";
-		job.lock_database_name = job.database_name + ".lock";
-	}
-	if (!run(prog, meta_depth, jobs))
-		status = false;
-	if (debug) {
-		msg(prog, "INFO") << "Redo status = " << status << ".\n" << std::flush;
+		std::vector<PathID> names;
+		plan.watched(names);
+		watcher.watch(prog, names);
+		if (!watcher.wait(prog)) return false;
 	}
-	return status;
+#else
+	static_cast<void>(meta_depth);
+	static_cast<void>(filev);
+	msg(prog, "ERROR") << "Watching for changes is not available on this platform.\n";
+	return false;
+#endif
 }
 
 static 
@@ -1230,13 +5280,25 @@ main ( int argc, const char * argv[] )
 	const char * prog(basename_of(argv[0]));
 
         std::vector<const char *> filev;
+	bool use_log_database(false);
+	bool use_file_info_server(false);
+	bool watch_mode(false);
 
 	try {
 		std::string jobserver_fds_string;
+		std::string jobserver_auth_string;
+		const char * jobserver_auth_c_str = 0;
+		const char * jobserver_style = 0;
 		std::string redoparent_fd_string;
+		std::string hash_algorithm_string;
+		std::string file_info_server_fd_string;
 		const char * jobserver_fds_c_str = 0;
+		const char * file_info_server_fd_c_str = 0;
 		const char * redoparent_fd_c_str = 0;
 		const char * directory = 0;
+		const char * hash_algorithm_name = 0;
+		const char * load_average_c_str = 0;
+		std::string load_average_string;
 		unsigned long max_jobs = 0;
 		popt::bool_definition silent_option('s', "silent", "Operate quietly.", silent);
 		popt::bool_definition quiet_option('\0', "quiet", "alias for --silent", silent);
@@ -1244,8 +5306,15 @@ main ( int argc, const char * argv[] )
 		popt::bool_definition debug_option('d', "debug", "Output debugging information.", debug);
 		popt::bool_definition verbose_option('\0', "verbose", "Display information about the database.", verbose);
 		popt::bool_definition print_option('p', "print", "alias for --verbose", verbose);
-		popt::unsigned_number_definition jobs_option('j', "jobs", "number", "Allow multiple jobs to run in parallel.", max_jobs, 0);
+		popt::unsigned_number_definition jobs_option('j', "jobs", "number", "Allow multiple jobs to run in parallel, 0 meaning as many as there are processors available.", max_jobs, 0);
+		equals_string_definition load_average_option('l', "load-average", "load", "Start no more parallel jobs whilst the load average is this or more.", load_average_c_str);
+		equals_string_definition jobserver_style_option('\0', "jobserver-style", "pipe|fifo", "Provide parallel jobs with job slots through an anonymous pipe, or a named FIFO that GNU make 4.4 can share.", jobserver_style);
+		popt::unsigned_number_definition max_memory_option('\0', "max-memory", "MiB", "Hold back jobs that would take the total recorded peak memory use of running jobs past this.", max_memory_mib, 0);
 		popt::string_definition directory_option('C', "directory", "directory", "Change to directory before doing anything.", directory);
+		equals_string_definition hash_algorithm_option('\0', "hash-algorithm", "cubehash|xxh3-128", "Hash the contents of files with this algorithm.", hash_algorithm_name);
+		popt::bool_definition log_database_option('\0', "log-database", "Keep the database in the single file .redo/database.log.", use_log_database);
+		popt::bool_definition file_info_server_option('\0', "file-info-server", "Serve batched file information lookups from one process that remembers file hashes for the whole build.", use_file_info_server);
+		popt::bool_definition watch_option('\0', "watch", "Rebuild whenever anything that the targets were built from changes.", watch_mode);
 		popt::definition * top_table[] = {
 			&silent_option,
 			&quiet_option,
@@ -1254,12 +5323,22 @@ main ( int argc, const char * argv[] )
 			&verbose_option,
 			&print_option,
 			&jobs_option,
-			&directory_option
+			&load_average_option,
+			&max_memory_option,
+			&jobserver_style_option,
+			&directory_option,
+			&hash_algorithm_option,
+			&log_database_option,
+			&file_info_server_option,
+			&watch_option
 		};
 		popt::top_table_definition main_option(sizeof top_table/sizeof *top_table, top_table, "Main options", "filename(s)");
 		catchall_definition ignore;
 		special_string_definition jobserver_option('\0', "jobserver-fds", "fd-list", "Provide the file descriptor numbers of the jobserver pipe.", jobserver_fds_c_str);
+		special_string_definition jobserver_auth_option('\0', "jobserver-auth", "fifo:path|fd-list", "Provide the name of the jobserver FIFO, or the file descriptor numbers of the jobserver pipe.", jobserver_auth_c_str);
 		special_string_definition redoparent_option('\0', "redoparent-fd", "fd", "Provide the file descriptor number of the redo database current parent file.", redoparent_fd_c_str);
+		special_string_definition hash_algorithm_env_option('\0', "hash-algorithm", "name", "Provide the hash algorithm of the redo database.", hash_algorithm_name);
+		special_string_definition file_info_server_env_option('\0', "file-info-server-fd", "fd", "Provide the file descriptor number of the file information server socket.", file_info_server_fd_c_str);
 		popt::definition * make_env_top_table[] = {
 			&silent_option,
 			&quiet_option,
@@ -1268,7 +5347,9 @@ main ( int argc, const char * argv[] )
 			&verbose_option,
 			&print_option,
 			&jobs_option,
+			&load_average_option,
 			&jobserver_option,
+			&jobserver_auth_option,
 			&ignore
 		};
 		popt::table_definition make_env_main_option(sizeof make_env_top_table/sizeof *make_env_top_table, make_env_top_table, "Main options (environment variable arguments)");
@@ -1281,7 +5362,12 @@ main ( int argc, const char * argv[] )
 			&print_option,
 			&jobs_option,
 			&jobserver_option,
+			&jobserver_auth_option,
+			&load_average_option,
+			&max_memory_option,
 			&redoparent_option,
+			&hash_algorithm_env_option,
+			&file_info_server_env_option,
 		};
 		popt::table_definition redo_env_main_option(sizeof redo_env_top_table/sizeof *redo_env_top_table, redo_env_top_table, "Main options (environment variable arguments)");
 
@@ -1307,7 +5393,11 @@ main ( int argc, const char * argv[] )
 				if (!filev.empty())
 					msg(prog, "WARNING") << var << ": Ignoring filenames.\n";
 				if (jobserver_fds_c_str) { jobserver_fds_string = jobserver_fds_c_str; jobserver_fds_c_str = 0; }
+				if (jobserver_auth_c_str) { jobserver_auth_string = jobserver_auth_c_str; jobserver_auth_c_str = 0; }
 				if (redoparent_fd_c_str) { redoparent_fd_string = redoparent_fd_c_str; redoparent_fd_c_str = 0; }
+				if (hash_algorithm_name) { hash_algorithm_string = hash_algorithm_name; hash_algorithm_name = 0; }
+				if (file_info_server_fd_c_str) { file_info_server_fd_string = file_info_server_fd_c_str; file_info_server_fd_c_str = 0; }
+				if (load_average_c_str) { load_average_string = load_average_c_str; load_average_c_str = 0; }
 				break;
 			}
 		}
@@ -1325,31 +5415,72 @@ main ( int argc, const char * argv[] )
 		}
 		if (jobserver_fds_c_str) { jobserver_fds_string = jobserver_fds_c_str; jobserver_fds_c_str = 0; }
 		if (redoparent_fd_c_str) { redoparent_fd_string = redoparent_fd_c_str; redoparent_fd_c_str = 0; }
+		if (hash_algorithm_name) { hash_algorithm_string = hash_algorithm_name; hash_algorithm_name = 0; }
+		if (load_average_c_str) { load_average_string = load_average_c_str; load_average_c_str = 0; }
 
-		if (!jobserver_fds_string.empty()) {
-			if (!parse_fds(prog, jobserver_fds_string.c_str(), jobserver_fds, sizeof jobserver_fds/sizeof *jobserver_fds))
+		if (!load_average_string.empty()) {
+			const char * end(load_average_string.c_str());
+			max_load_average = std::strtod(load_average_string.c_str(), const_cast<char **>(&end));
+			if (end == load_average_string.c_str() || *end || max_load_average < 0.0) {
+				msg(prog, "ERROR") << load_average_string << ": Invalid load average.\n";
 				return EXIT_FAILURE;
+			}
+		}
+		const bool use_fifo(jobserver_style && 0 == std::strcmp(jobserver_style, "fifo"));
+		if (jobserver_style && !use_fifo && 0 != std::strcmp(jobserver_style, "pipe")) {
+			msg(prog, "ERROR") << jobserver_style << ": Unknown jobserver style.\n";
+			return EXIT_FAILURE;
+		}
+		if (!jobserver_auth_string.empty() || !jobserver_fds_string.empty()) {
+			if (!jobserver_auth_string.empty()) {
+				if (!open_jobserver(prog, jobserver_auth_string))
+					return EXIT_FAILURE;
+			} else {
+				if (!parse_fds(prog, jobserver_fds_string.c_str(), jobserver_fds, sizeof jobserver_fds/sizeof *jobserver_fds))
+					return EXIT_FAILURE;
+			}
 			if (jobs_option.is_set())
 				msg(prog, "WARNING") << "Ignoring jobs option when there's already a job server.\n";
 		} else {
 			if (jobs_option.is_set()) {
 				if (max_jobs < 1U) {
-					msg(prog, "ERROR") << "Invalid job limit.\n";
-					return EXIT_FAILURE;
+					max_jobs = available_processors();
+					if (verbose)
+						msg(prog, "INFO") << "Running up to " << max_jobs << " jobs in parallel.\n";
 				}
-				if (0 > pipe(jobserver_fds)) {
-					const int error(errno);
-					msg(prog, "ERROR") << "pipe: " << std::strerror(error) << "\n";
+				if (!create_jobserver(prog, use_fifo))
 					return EXIT_FAILURE;
-				}
 				for (unsigned m(max_jobs); m > 1U; --m) 
 					vacate_job_slot(prog);
+#if !defined(__OS2__) && !defined(__WIN32__) && !defined(__NT__)
+				// GNU make run by .do scripts takes its job slots from the same FIFO.
+				if (!jobserver_fifo.empty()) {
+					std::ostringstream makeflags;
+					if (const char * old = std::getenv("MAKEFLAGS")) makeflags << old;
+					makeflags << " -j" << max_jobs << " --jobserver-auth=fifo:" << jobserver_fifo;
+					setenv("MAKEFLAGS", makeflags.str().c_str(), 1);
+				}
+#endif
 			}
 		}
 		if (!redoparent_fd_string.empty()) {
 			if (!parse_fds(prog, redoparent_fd_string.c_str(), &redoparent_fd, 1U))
 				return EXIT_FAILURE;
 		}
+		if (!file_info_server_fd_string.empty()) {
+			if (!parse_fds(prog, file_info_server_fd_string.c_str(), &file_info_server_fd, 1U))
+				return EXIT_FAILURE;
+#if !defined(__OS2__) && !defined(__WIN32__) && !defined(__NT__)
+			set_close_on_exec(file_info_server_fd, true);
+#endif
+		}
+		if (!hash_algorithm_string.empty()) {
+			hash_algorithm = parse_hash_algorithm(hash_algorithm_string.data(), hash_algorithm_string.length());
+			if (UNKNOWN_HASH_ALGORITHM == hash_algorithm) {
+				msg(prog, "ERROR") << hash_algorithm_string << ": Unknown hash algorithm.\n";
+				return EXIT_FAILURE;
+			}
+		}
 	} catch (const popt::error & e) {
 		msg(prog, "ERROR") << e.arg << ": " << e.msg << "\n";
 		return EXIT_FAILURE;
@@ -1386,6 +5517,7 @@ main ( int argc, const char * argv[] )
 	) {
 		const bool r(redo_ifchange(prog, meta_depth, filev));
 		procure_job_slot(prog);
+		report_statistics(prog);
 		return r ? EXIT_SUCCESS : EXIT_FAILURE;
 	}
 	else
@@ -1395,8 +5527,23 @@ main ( int argc, const char * argv[] )
 #endif
 	) {
 		posix_mkdir(".redo", 0777);
-		const bool r(redo(true, prog, meta_depth, filev));
+		const bool serving(use_file_info_server && -1 == file_info_server_fd);
+		if (serving) {
+#if !defined(__OS2__) && !defined(__WIN32__) && !defined(__NT__)
+			if (!start_file_info_server(prog))
+				return EXIT_FAILURE;
+#else
+			msg(prog, "WARNING") << "The file information server is not available on this platform.\n";
+#endif
+		}
+		if (use_log_database && !log_database.create(prog))
+			return EXIT_FAILURE;
+		if (log_database.enabled())
+			log_database.compact(prog);
+		const bool r(watch_mode ? watch(prog, meta_depth, filev) : redo(true, prog, meta_depth, filev));
+		if (serving) stop_file_info_server();
 		procure_job_slot(prog);
+		report_statistics(prog);
 		return r ? EXIT_SUCCESS : EXIT_FAILURE;
 	}
 	if (0 == std::strcmp(prog, "cubehash")
@@ -1405,11 +5552,15 @@ main ( int argc, const char * argv[] )
 #endif
 	)
 	{
-		for ( std::vector<const char *>::const_iterator i = filev.begin(); i != filev.end(); ++i ) {
-			const char * arg(*i);
-			const Information & info(get_file_info(arg, 0));
-			write_db_line(std::cout, info, arg);
+		FileInfoRequests requests;
+		for ( std::vector<const char *>::const_iterator i = filev.begin(); i != filev.end(); ++i )
+			requests.push_back(FileInfoRequest(paths.intern(*i), 0));
+		batch_file_info(requests);
+		for ( std::size_t j(0); j < filev.size(); ++j ) {
+			const Information & info(get_file_info(requests[j].name, 0));
+			write_hash_line(std::cout, info, filev[j]);
 		}
+		report_statistics(prog);
 		return EXIT_SUCCESS;
 	}
 	else